@@ -1,49 +1,56 @@
 #pragma once
 #include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 
-struct Color {
-    int r;
-    int g;
-    int b;
-    int a;
+// Stored pixel: RGBA8 in one 32-bit word, with the bytes R, G, B, A in memory order on
+// any host. This is what the color buffers hold and what the window texture expects.
+using Pixel = std::uint32_t;
 
-    Color() : r(0), g(0), b(0), a(255) {}
+// Working color of the shaders: one float per channel, 1.0 is full intensity. Channels
+// may leave [0, 1] while shading; they only saturate when packed into a Pixel.
+struct alignas(16) Color {
+    float r;
+    float g;
+    float b;
+    float a;
 
-    Color(int red, int green, int blue, int alpha = 255) {
-        r = static_cast<Uint8>(std::min(std::max(red, 0), 255));
-        g = static_cast<Uint8>(std::min(std::max(green, 0), 255));
-        b = static_cast<Uint8>(std::min(std::max(blue, 0), 255));
-        a = static_cast<Uint8>(std::min(std::max(alpha, 0), 255));
-    }
+    Color() : r(0.0f), g(0.0f), b(0.0f), a(1.0f) {}
 
-    Color(float red, float green, float blue, float alpha = 1.0f) {
-        r = std::clamp(static_cast<Uint8>(red * 255), Uint8(0), Uint8(255));
-        g = std::clamp(static_cast<Uint8>(green * 255), Uint8(0), Uint8(255));
-        b = std::clamp(static_cast<Uint8>(blue * 255), Uint8(0), Uint8(255));
-        a = std::clamp(static_cast<Uint8>(alpha * 255), Uint8(0), Uint8(255));
-    }
+    // 8-bit channel values, 0 to 255
+    Color(int red, int green, int blue, int alpha = 255)
+        : r(red / 255.0f), g(green / 255.0f), b(blue / 255.0f), a(alpha / 255.0f) {}
+
+    Color(float red, float green, float blue, float alpha = 1.0f)
+        : r(red), g(green), b(blue), a(alpha) {}
 
     // Overload the + operator to add colors
     Color operator+(const Color& other) const {
-        return Color(
-                std::min(255, int(r) + int(other.r)),
-                std::min(255, int(g) + int(other.g)),
-                std::min(255, int(b) + int(other.b)),
-                std::min(255, int(a) + int(other.a))
-        );
+        return Color(r + other.r, g + other.g, b + other.b, a + other.a);
     }
 
     // Overload the * operator to scale colors by a factor
     Color operator*(float factor) const {
-        return Color(
-                std::clamp(static_cast<Uint8>(r * factor), Uint8(0), Uint8(255)),
-                std::clamp(static_cast<Uint8>(g * factor), Uint8(0), Uint8(255)),
-                std::clamp(static_cast<Uint8>(b * factor), Uint8(0), Uint8(255)),
-                std::clamp(static_cast<Uint8>(a * factor), Uint8(0), Uint8(255))
-        );
+        return Color(r * factor, g * factor, b * factor, a * factor);
     }
 
     // Friend function to allow float * Color
-    friend Color operator*(float factor, const Color& color);
-};
\ No newline at end of file
+    friend Color operator*(float factor, const Color& color) {
+        return color * factor;
+    }
+};
+
+// Rounds every channel to 8 bits, saturating to [0, 255] (NaN becomes 0). This is the
+// scalar reference; the rasterizer packs whole stamps with the kernels in stamp.h.
+inline Pixel packColor(const Color& c) {
+    auto channel = [](float value) {
+        return static_cast<std::uint8_t>(std::min(std::max(0.0f, value * 255.0f + 0.5f), 255.0f));
+    };
+    std::uint8_t bytes[4] = {channel(c.r), channel(c.g), channel(c.b), channel(c.a)};
+
+    // Memory order R, G, B, A regardless of the host's endianness
+    Pixel pixel;
+    std::memcpy(&pixel, bytes, sizeof(pixel));
+    return pixel;
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <algorithm>
+#include <vector>
+#include "object.h"
+#include "tiles.h"
+
+// Everything that decides the pixels of a draw. Two draws with equal states rasterize to
+// the same pixels, so a tile only needs to be drawn again when a draw touching it changed.
+struct DrawState {
+    DrawUniforms uniforms;
+    glm::mat4 viewport;
+    Shader shader;
+    CullMode cullMode;
+    const Mesh* mesh;   // meshes are immutable, so the same mesh means the same vertices
+    InstanceBuffer instances; // held so a new buffer can never reuse the old one's address
+    TileRect bounds;    // pixels covered in the frame the state was recorded in
+
+    bool sameAs(const DrawState& other) const {
+        return shader == other.shader && cullMode == other.cullMode && mesh == other.mesh && instances == other.instances &&
+               uniforms.model == other.uniforms.model && uniforms.modelViewProjection == other.uniforms.modelViewProjection &&
+               viewport == other.viewport;
+    }
+};
+
+// Tiles that have to be cleared and drawn again this frame. The rest of the frame is the
+// same as the previous one and is reused as it is, color and depth.
+class DirtyTiles {
+public:
+    std::vector<int> tiles; // dirty tiles, in tile order
+    bool full = true;       // every tile is dirty: clear and draw the whole frame
+
+    // Forces the next frame to be drawn from scratch (resize, starfield moved, ...)
+    void invalidate() {
+        valid = false;
+    }
+
+    // Compares the draws of this frame with the previous one. A changed draw dirties the
+    // tiles under both its old and its new bounds; added or removed draws dirty theirs.
+    void update(const std::vector<DrawState>& draws) {
+        tiles.clear();
+        marked.assign(tileCount(), 0);
+        columns = tilesX();
+        full = !valid;
+
+        if (!full) {
+            size_t count = std::max(draws.size(), previous.size());
+            for (size_t i = 0; i < count; ++i) {
+                if (i >= draws.size()) {
+                    mark(previous[i].bounds);
+                } else if (i >= previous.size()) {
+                    mark(draws[i].bounds);
+                } else if (!draws[i].sameAs(previous[i])) {
+                    mark(previous[i].bounds);
+                    mark(draws[i].bounds);
+                }
+            }
+        }
+
+        for (int tile = 0; tile < tileCount(); ++tile) {
+            if (full || marked[tile]) {
+                tiles.push_back(tile);
+            }
+        }
+
+        previous = draws;
+        valid = true;
+    }
+
+    // Off-screen pixels are never dirty
+    bool contains(int x, int y) const {
+        if (x < 0 || y < 0 || x >= screenWidth || y >= screenHeight)
+            return false;
+        return full || marked[(y / TILE_SIZE) * columns + x / TILE_SIZE];
+    }
+
+private:
+    std::vector<DrawState> previous;
+    std::vector<char> marked;
+    int columns = 0;
+    bool valid = false;
+
+    void mark(const TileRect& bounds) {
+        if (isEmpty(bounds))
+            return;
+
+        for (int ty = bounds.minY / TILE_SIZE; ty <= bounds.maxY / TILE_SIZE; ++ty) {
+            for (int tx = bounds.minX / TILE_SIZE; tx <= bounds.maxX / TILE_SIZE; ++tx) {
+                marked[ty * columns + tx] = 1;
+            }
+        }
+    }
+};
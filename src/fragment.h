@@ -9,13 +9,15 @@ struct Fragment {
     float intensity;
     glm::vec3 worldPos;
     glm::vec3 originalPos;
+    float seed = 0.0f; // seed of the instance being drawn, 0 outside instanced draws
 };
 
 struct Vertex {
-    glm::vec3 position;
+    glm::vec3 position; // screen space once primitive assembly has clipped and projected it
     glm::vec3 normal;
     glm::vec3 tex;
     glm::vec3 worldPos;
     glm::vec3 originalPos;
+    glm::vec4 clipPosition;
 };
 
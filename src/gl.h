@@ -7,7 +7,9 @@
 #include <fstream>
 #include <sstream>
 #include <algorithm>
-#include <SDL.h>
+#include <bit>
+#include <cstdint>
+#include <cstring>
 #include "color.h"
 #include "fragment.h"
 #include "noise.h"
@@ -43,49 +45,255 @@ struct Face {
     std::array<int, 3> texIndices;
 };
 
-SDL_Window* window = nullptr;
-SDL_Renderer* renderer = nullptr;
-const int SCREEN_WIDTH = 1280;
-const int SCREEN_HEIGHT = 720;
+// Size of the render targets; changed at runtime with resizeRenderTargets()
+int screenWidth = 1280;
+int screenHeight = 720;
 
 Color clearColor = {0, 0, 0, 255}; // Initially set to black
-std::array<std::array<float, SCREEN_WIDTH>, SCREEN_HEIGHT> zbuffer;
+const float clearDepth = 99999.0f;
+// Doubled screen-space area below which nothing is rasterized: one pixel at 1280x720,
+// scaled with the render area so every resolution drops the same triangles
+float minTriangleArea = 1.0f;
+
+// Storage order of the color and depth buffers. Pixels are always addressed through
+// pixelIndex(); the color buffer is resolved back to rows when it is presented.
+enum class BufferLayout {
+    Linear, // row-major
+    Tiled,  // 8x8 pixel tiles stored row-major, row-major inside each tile
+    Morton, // 64x64 pixel tiles stored row-major, Z-order inside each tile
+};
+
+BufferLayout bufferLayout = BufferLayout::Linear;
+
+const char* bufferLayoutName(BufferLayout layout) {
+    switch (layout) {
+        case BufferLayout::Tiled:
+            return "tiled";
+        case BufferLayout::Morton:
+            return "morton";
+        default:
+            return "linear";
+    }
+}
+
+bool parseBufferLayout(const std::string& name, BufferLayout& layout) {
+    for (BufferLayout candidate : {BufferLayout::Linear, BufferLayout::Tiled, BufferLayout::Morton}) {
+        if (name == bufferLayoutName(candidate)) {
+            layout = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Storage is padded to whole 64x64 tiles so that every layout fits in the same buffer
+const int LAYOUT_TILE_SIZE = 64;
+int bufferWidth = 0;
+int bufferHeight = 0;
+
+// Spreads the 6 bits of a coordinate inside a 64x64 tile to the even bit positions
+constexpr std::array<int, LAYOUT_TILE_SIZE> mortonSpread = [] {
+    std::array<int, LAYOUT_TILE_SIZE> spread{};
+    for (int i = 0; i < LAYOUT_TILE_SIZE; ++i) {
+        for (int bit = 0; bit < 6; ++bit) {
+            spread[i] |= ((i >> bit) & 1) << (2 * bit);
+        }
+    }
+    return spread;
+}();
+
+inline int pixelIndex(int x, int y) {
+    switch (bufferLayout) {
+        case BufferLayout::Tiled:
+            return (((y >> 3) * (bufferWidth >> 3) + (x >> 3)) << 6) | ((y & 7) << 3) | (x & 7);
+        case BufferLayout::Morton:
+            return (((y >> 6) * (bufferWidth >> 6) + (x >> 6)) << 12) | mortonSpread[x & 63] | (mortonSpread[y & 63] << 1);
+        default:
+            return y * bufferWidth + x;
+    }
+}
+
+using ColorBuffer = std::vector<Pixel>;
+
+// framebuffer is the buffer every frame is drawn into. Finished frames are resolved out of
+// it before the next one starts, so it still holds the previous frame when drawing begins.
+ColorBuffer colorBuffer;
+ColorBuffer* framebuffer = &colorBuffer;
+std::vector<float> zbuffer;
+
+inline Pixel& colorAt(int x, int y) {
+    return (*framebuffer)[pixelIndex(x, y)];
+}
+
+inline float& depthAt(int x, int y) {
+    return zbuffer[pixelIndex(x, y)];
+}
+
+// Copies row y of a finished color buffer to dst in plain left-to-right order
+void resolveRow(const ColorBuffer& buffer, int y, Pixel* dst) {
+    if (bufferLayout == BufferLayout::Linear) {
+        std::memcpy(dst, &buffer[y * bufferWidth], screenWidth * sizeof(Pixel));
+    } else {
+        for (int x = 0; x < screenWidth; ++x) {
+            dst[x] = buffer[pixelIndex(x, y)];
+        }
+    }
+}
+
+// Coarse level of the depth hierarchy: bounds of the depth stored in every 8x8 block of
+// the zbuffer, kept up to date by the writes so queries never read per-pixel depth. Depth
+// only ever decreases, so minZ is exact. maxZ is only an upper bound: it is lowered to the
+// farthest depth written once every pixel of the block has been written again.
+const int DEPTH_BLOCK_SIZE = 8;
+int depthBlocksX = 0;
+int depthBlocksY = 0;
+
+struct DepthBlock {
+    float minZ;
+    float maxZ;
+    float writtenMaxZ;     // farthest depth written since maxZ was last lowered
+    std::uint64_t written; // pixels written since then, bit (y % 8) * 8 + x % 8
+};
+
+const DepthBlock clearedDepthBlock = {clearDepth, clearDepth, -clearDepth, 0};
+
+std::vector<DepthBlock> depthBlocks;
+
+// The zbuffer is never cleared as a whole. Every 64x64 depth tile remembers the frame
+// (epoch) it was last cleared in; clear() only bumps the frame epoch, and a tile with a
+// stale epoch is reset the first time something draws into it.
+const int DEPTH_TILE_SIZE = 64;
+int depthTilesX = 0;
+int depthTilesY = 0;
+
+static_assert(DEPTH_TILE_SIZE % DEPTH_BLOCK_SIZE == 0, "depth blocks must not straddle depth tiles");
+
+std::vector<std::uint32_t> depthTileEpochs;
+std::uint32_t depthEpoch = 0;
+
+// (Re)allocates every render target for a width x height frame. Nothing may be rendering
+// while this runs. Depth starts out stale, so it is cleared on first use.
+void resizeRenderTargets(int width, int height) {
+    screenWidth = width;
+    screenHeight = height;
+    minTriangleArea = float(width) * float(height) / (1280.0f * 720.0f);
+    bufferWidth = (width + LAYOUT_TILE_SIZE - 1) / LAYOUT_TILE_SIZE * LAYOUT_TILE_SIZE;
+    bufferHeight = (height + LAYOUT_TILE_SIZE - 1) / LAYOUT_TILE_SIZE * LAYOUT_TILE_SIZE;
+
+    colorBuffer.assign(bufferWidth * bufferHeight, 0);
+    colorBuffer.shrink_to_fit();
+    zbuffer.assign(bufferWidth * bufferHeight, clearDepth);
+    zbuffer.shrink_to_fit();
+
+    depthBlocksX = (width + DEPTH_BLOCK_SIZE - 1) / DEPTH_BLOCK_SIZE;
+    depthBlocksY = (height + DEPTH_BLOCK_SIZE - 1) / DEPTH_BLOCK_SIZE;
+    depthBlocks.assign(depthBlocksX * depthBlocksY, clearedDepthBlock);
+
+    depthTilesX = (width + DEPTH_TILE_SIZE - 1) / DEPTH_TILE_SIZE;
+    depthTilesY = (height + DEPTH_TILE_SIZE - 1) / DEPTH_TILE_SIZE;
+    depthTileEpochs.assign(depthTilesX * depthTilesY, depthEpoch - 1);
+}
+
+void prepareDepthTile(int tileX, int tileY) {
+    std::uint32_t& epoch = depthTileEpochs[tileY * depthTilesX + tileX];
+    if (epoch == depthEpoch)
+        return;
+
+    int startX = tileX * DEPTH_TILE_SIZE;
+    int startY = tileY * DEPTH_TILE_SIZE;
+    int endX = std::min(startX + DEPTH_TILE_SIZE, screenWidth);
+    int endY = std::min(startY + DEPTH_TILE_SIZE, screenHeight);
+    for (int y = startY; y < endY; ++y) {
+        for (int x = startX; x < endX; ++x) {
+            depthAt(x, y) = clearDepth;
+        }
+    }
+    for (int by = startY / DEPTH_BLOCK_SIZE; by * DEPTH_BLOCK_SIZE < endY; ++by) {
+        for (int bx = startX / DEPTH_BLOCK_SIZE; bx * DEPTH_BLOCK_SIZE < endX; ++bx) {
+            depthBlocks[by * depthBlocksX + bx] = clearedDepthBlock;
+        }
+    }
+    epoch = depthEpoch;
+}
+
+// Forces the depth tile to be reset the next time something draws into it
+void invalidateDepthTile(int tileX, int tileY) {
+    depthTileEpochs[tileY * depthTilesX + tileX] = depthEpoch - 1;
+}
+
+// Records depth written into one row of a block: the pixels in lanes (bit i is pixel x + i,
+// x a multiple of DEPTH_BLOCK_SIZE) with depths between nearestZ and farthestZ
+void markDepthWritten(int x, int y, int lanes, float nearestZ, float farthestZ) {
+    int blockX = x / DEPTH_BLOCK_SIZE;
+    int blockY = y / DEPTH_BLOCK_SIZE;
+    DepthBlock& block = depthBlocks[blockY * depthBlocksX + blockX];
+    block.minZ = std::min(block.minZ, nearestZ);
+    block.writtenMaxZ = std::max(block.writtenMaxZ, farthestZ);
+    block.written |= std::uint64_t(lanes) << ((y % DEPTH_BLOCK_SIZE) * DEPTH_BLOCK_SIZE);
+
+    // Every on-screen pixel of the block was written: no depth older than those writes is left
+    int width = std::min(DEPTH_BLOCK_SIZE, screenWidth - blockX * DEPTH_BLOCK_SIZE);
+    int height = std::min(DEPTH_BLOCK_SIZE, screenHeight - blockY * DEPTH_BLOCK_SIZE);
+    std::uint64_t row = (std::uint64_t(1) << width) - 1;
+    std::uint64_t all = 0;
+    for (int r = 0; r < height; ++r) {
+        all |= row << (r * DEPTH_BLOCK_SIZE);
+    }
+    if ((block.written & all) == all) {
+        block.maxZ = std::min(block.maxZ, block.writtenMaxZ);
+        block.writtenMaxZ = -clearDepth;
+        block.written = 0;
+    }
+}
+
+void markDepthWritten(int x, int y, float z) {
+    markDepthWritten(x - x % DEPTH_BLOCK_SIZE, y, 1 << (x % DEPTH_BLOCK_SIZE), z, z);
+}
+
+const DepthBlock& depthBlock(int blockX, int blockY) {
+    return depthBlocks[blockY * depthBlocksX + blockX];
+}
 
 // Function to set a specific pixel in the framebuffer to the currentColor
 void point(Fragment f) {
-    if (f.position.z < zbuffer[f.position.y][f.position.x]) {
-        SDL_SetRenderDrawColor(renderer, f.color.r, f.color.g, f.color.b, f.color.a);
-        SDL_RenderDrawPoint(renderer, f.position.x, f.position.y);
-        zbuffer[f.position.y][f.position.x] = f.position.z;
+    int x = static_cast<int>(f.position.x);
+    int y = static_cast<int>(f.position.y);
+    if (x < 0 || y < 0 || x >= screenWidth || y >= screenHeight)
+        return;
+
+    prepareDepthTile(x / DEPTH_TILE_SIZE, y / DEPTH_TILE_SIZE);
+    float& depth = depthAt(x, y);
+    if (f.position.z < depth) {
+        colorAt(x, y) = packColor(f.color);
+        depth = f.position.z;
+        markDepthWritten(x, y, depth);
     }
 }
 
+// Writes the color of a fragment that already passed the depth test during rasterization
+void colorPoint(const Fragment& f) {
+    colorAt(static_cast<int>(f.position.x), static_cast<int>(f.position.y)) = packColor(f.color);
+}
 
 float ox = 1200.0f;
 float oy = 3000.0f;
 
-// Function to clear the framebuffer with the clearColor
-void clear() {
-    SDL_SetRenderDrawColor(renderer, clearColor.r, clearColor.g, clearColor.b, clearColor.a);
-    SDL_RenderClear(renderer);
-
-    // Clean the zbuffer
-    for (auto &row : zbuffer) {
-        std::fill(row.begin(), row.end(), 99999.0f);
-    }
+// The starfield drifts slowly; it only moves when this is called
+void advanceStars() {
+    ox += 0.001f;
+    oy += 0.001f;
+}
 
-    // Generate stars
+// Generate stars. Only the stars for which keep(x, y) returns true are drawn.
+template <typename Filter>
+void drawStars(Filter&& keep) {
     int numStars = 2500;
     FastNoiseLite noise;
     noise.SetNoiseType(FastNoiseLite::NoiseType_OpenSimplex2);
 
-    ox += 0.001f;
-    oy += 0.001f;
-
-
     for (int i = 0; i < numStars; i += 5) {
-        float x = noise.GetNoise((float)i + ox, oy) * SCREEN_WIDTH;
-        float y = noise.GetNoise((float)i + oy, ox) * SCREEN_HEIGHT;
+        float x = noise.GetNoise((float)i + ox, oy) * screenWidth;
+        float y = noise.GetNoise((float)i + oy, ox) * screenHeight;
         float z = noise.GetNoise((float)i + ox, oy) * 100.0f;
 
         x = std::abs(x);
@@ -102,9 +310,19 @@ void clear() {
             size
         };
 
-        point(f);
+        if (keep(static_cast<int>(x), static_cast<int>(y))) {
+            point(f);
+        }
     }
 }
 
+// Function to clear the framebuffer with the clearColor
+void clear() {
+    // Both buffers are contiguous, so each clear is a single fill over the whole surface
+    std::fill(framebuffer->begin(), framebuffer->end(), packColor(clearColor));
 
+    // Clean the zbuffer: every depth tile becomes stale and is reset on first use
+    ++depthEpoch;
 
+    drawStars([](int, int) { return true; });
+}
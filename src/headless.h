@@ -0,0 +1,120 @@
+#pragma once
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "gl.h"
+#include "present.h"
+
+// True when pattern is a usable file name pattern for ImageSink: exactly one integer
+// conversion for the frame number (flags, width and precision allowed, but no '*' and no
+// length modifier), and no other '%' except "%%".
+bool isFramePattern(const std::string& pattern) {
+    int conversions = 0;
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        if (pattern[i] != '%')
+            continue;
+
+        if (++i < pattern.size() && pattern[i] == '%')
+            continue;
+        while (i < pattern.size() && std::strchr("-+ #0", pattern[i]))
+            ++i;
+        while (i < pattern.size() && std::isdigit(static_cast<unsigned char>(pattern[i])))
+            ++i;
+        if (i < pattern.size() && pattern[i] == '.') {
+            ++i;
+            while (i < pattern.size() && std::isdigit(static_cast<unsigned char>(pattern[i])))
+                ++i;
+        }
+        if (i >= pattern.size() || !std::strchr("diouxX", pattern[i]))
+            return false;
+        ++conversions;
+    }
+    return conversions == 1;
+}
+
+// Headless backend: no window, every frame is written to disk as a binary PPM. The file
+// name is a printf pattern that receives the frame number, e.g. "frame_%04d.ppm". Frames
+// are always width x height (the window size); with dynamic resolution a smaller render
+// target is stretched back up with bilinear filtering, as the window's texture is.
+class ImageSink : public FrameSink {
+public:
+    ImageSink(std::string pattern, int width, int height) : pattern(std::move(pattern)), width(width), height(height) {}
+
+    bool open() override {
+        return true;
+    }
+
+    void close() override {}
+
+    // Converts the frame to tightly packed RGB rows at the output size
+    void upload(const ResolvedFrame& frame) override {
+        const std::vector<Pixel>& source = frame.pixels;
+        int sourceWidth = frame.width;
+        int sourceHeight = frame.height;
+
+        pixels.resize(size_t(width) * height * 3);
+        if (sourceWidth == width && sourceHeight == height) {
+            for (size_t i = 0; i < source.size(); ++i) {
+                auto* rgba = reinterpret_cast<const unsigned char*>(&source[i]);
+                std::copy(rgba, rgba + 3, &pixels[i * 3]);
+            }
+            return;
+        }
+
+        // Pixel centers map to pixel centers; samples past the edges are clamped
+        float scaleX = float(sourceWidth) / float(width);
+        float scaleY = float(sourceHeight) / float(height);
+        for (int y = 0; y < height; ++y) {
+            float sy = std::clamp((y + 0.5f) * scaleY - 0.5f, 0.0f, float(sourceHeight - 1));
+            int y0 = static_cast<int>(sy);
+            int y1 = std::min(y0 + 1, sourceHeight - 1);
+            float fy = sy - y0;
+
+            for (int x = 0; x < width; ++x) {
+                float sx = std::clamp((x + 0.5f) * scaleX - 0.5f, 0.0f, float(sourceWidth - 1));
+                int x0 = static_cast<int>(sx);
+                int x1 = std::min(x0 + 1, sourceWidth - 1);
+                float fx = sx - x0;
+
+                auto texel = [&](int tx, int ty) {
+                    return reinterpret_cast<const unsigned char*>(&source[size_t(ty) * sourceWidth + tx]);
+                };
+                const unsigned char* a = texel(x0, y0);
+                const unsigned char* b = texel(x1, y0);
+                const unsigned char* c = texel(x0, y1);
+                const unsigned char* d = texel(x1, y1);
+
+                unsigned char* dst = &pixels[(size_t(y) * width + x) * 3];
+                for (int channel = 0; channel < 3; ++channel) {
+                    float top = a[channel] + (b[channel] - a[channel]) * fx;
+                    float bottom = c[channel] + (d[channel] - c[channel]) * fx;
+                    dst[channel] = static_cast<unsigned char>(top + (bottom - top) * fy + 0.5f);
+                }
+            }
+        }
+    }
+
+    void flip() override {
+        std::vector<char> path(pattern.size() + 32);
+        std::snprintf(path.data(), path.size(), pattern.c_str(), frame++);
+
+        std::ofstream file(path.data(), std::ios::binary);
+        if (!file) {
+            std::cerr << "Error: Failed to write " << path.data() << std::endl;
+            return;
+        }
+        file << "P6\n" << width << " " << height << "\n255\n";
+        file.write(reinterpret_cast<const char*>(pixels.data()), static_cast<std::streamsize>(pixels.size()));
+    }
+
+private:
+    std::string pattern;
+    int width;
+    int height;
+    int frame = 0;
+    std::vector<unsigned char> pixels;
+};
@@ -1,303 +1,718 @@
-#include <SDL.h>
 #include "gl.h"
 #include "camera.h"
 #include "uniforms.h"
 #include "shaders.h"
 #include "object.h"
 #include "triangle.h"
+#include "tiles.h"
+#include "vertices.h"
+#include "visibility.h"
+#include "dirty.h"
+#include "present.h"
+#include "headless.h"
+#include "resolution.h"
+#include "pacing.h"
+#ifndef NO_SDL
+#include "window.h"
+#endif
 #include <iostream>
 #include <vector>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+#include <memory>
 
 // Constantes.
 std::vector<Model> models;
 std::string planet;
 bool shipMoving = false;
+int asteroidCount = 0; // asteroids in the belt between Mars and Jupiter, none by default
 
 
-bool init() {
-    if (SDL_Init(SDL_INIT_VIDEO) != 0) {
-        std::cerr << "Error: Failed to initialize SDL: " << SDL_GetError() << std::endl;
-        return false;
-    }
+// Only the tiles whose draws changed since the previous frame are drawn again; the rest
+// of the frame is kept from the previous one, still in the color buffer
+DirtyTiles dirtyTiles;
+std::vector<DrawState> drawStates;
+bool hasPreviousFrame = false;
+bool fullRedraw = false;
 
-    window = SDL_CreateWindow("Software Renderer", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN);
-    if (!window) {
-        std::cerr << "Error: Failed to create SDL window: " << SDL_GetError() << std::endl;
-        return false;
-    }
+// Every buffer whose size follows the render resolution
+void resizeTargets(int width, int height) {
+    resizeRenderTargets(width, height);
+    resizeVisibility();
+    dirtyTiles.invalidate();
+}
+
+// Windowed mode presents through SDL. Headless mode needs no display and writes every
+// frame to disk; builds without SDL (NO_SDL) are always headless.
+#ifdef NO_SDL
+bool headless = true;
+#else
+bool headless = false;
+#endif
+std::string outputPattern = "frame_%04d.ppm";
+int frameLimit = 0; // stop after this many frames, 0 runs until the window is closed
+
+// Windowed runs are paced at targetFps by default, headless runs are uncapped
+PacingMode pacingMode = PacingMode::Fixed;
+bool pacingModeSet = false;
+double targetFps = 60.0;
 
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-    if (!renderer) {
-        std::cerr << "Error: Failed to create SDL renderer: " << SDL_GetError() << std::endl;
+bool init() {
+#ifndef NO_SDL
+    if (!headless && !openWindow(screenWidth, screenHeight)) {
         return false;
     }
+#endif
 
     setupNoise();
+    resizeTargets(screenWidth, screenHeight);
 
     return true;
 }
 
 using namespace std;
-void render() {
-    for (auto model : models) {
-        Uniforms uniform = model.uniforms;
-        uniform.model = model.modelMatrix;
+TileBins tileBins;
+RenderThread renderThread;
+
+// With dynamic resolution only a fraction of the window is rendered and the present
+// stretches it back up
+bool dynamicResolution = false;
+ResolutionController resolution;
+int windowWidth = 0;
+int windowHeight = 0;
+
+// Resizes the render targets to the window size times the resolution scale. Frames still
+// queued for rendering use the old buffers, so they are rendered first.
+void updateRenderSize() {
+    int width = std::max(1, static_cast<int>(std::lround(windowWidth * resolution.scale())));
+    int height = std::max(1, static_cast<int>(std::lround(windowHeight * resolution.scale())));
+    if (width == screenWidth && height == screenHeight)
+        return;
+
+    if (framesInFlight > 1) {
+        renderThread.drain();
+    }
+    resizeTargets(width, height);
+}
+bool depthPrepass = false; // lay down depth for the whole tile before shading anything
+
+enum class RenderMode {
+    Forward,    // shade while rasterizing (after the early depth test)
+    Visibility, // rasterize a visibility buffer, then shade each visible pixel once
+};
+RenderMode renderMode = RenderMode::Forward;
+
+Fragment shadeFragment(Shader shader, Fragment& fragment) {
+    switch (shader) {
+        case Shader::Earth:
+            return fragmentShaderEarth5(fragment);
+        case Shader::Sun:
+            return fragmentShaderSun(fragment);
+        case Shader::Jupiter:
+            return fragmentShaderJupiter(fragment);
+        case Shader::Uranus:
+            return fragmentShaderUranusRevised(fragment);
+        case Shader::Mars:
+            return fragmentShaderMars(fragment);
+        case Shader::Neptune:
+            return fragmentShaderNeptune(fragment);
+        case Shader::Noise:
+            return noiseFragmentShader(fragment);
+        case Shader::Ship:
+            return shipFragmentShader(fragment);
+        case Shader::ShipMoving:
+            return shipFragmentShaderMoving(fragment);
+        default:
+            return fragmentShader(fragment);
+    }
+}
 
-        // 1. Vertex Shader
-        // vertex -> transformedVertices
-        std::vector<Vertex> transformedVertices;
+// Seed of the instance a triangle was drawn for, 0 outside instanced draws
+float instanceSeed(const BinnedTriangle& binned) {
+    if (binned.instance < 0)
+        return 0.0f;
+    return (*drawStates[binned.draw].instances)[binned.instance].seed;
+}
 
-        for (int i = 0; i < model.vertices.size(); i+=3) {
-            glm::vec3 v = model.vertices[i];
-            glm::vec3 n = model.vertices[i+1];
-            glm::vec3 t = model.vertices[i+2];
+// The depth test happens during rasterization, so only visible pixels are shaded
+// and written as they come out of the rasterizer
+void rasterizeForward(int tile) {
+    if (tileBins.bins[tile].empty())
+        return;
 
-            auto vertex = Vertex{v, n, t};
+    TileRect rect = tileRect(tile);
+    prepareDepth(rect);
+    DepthMode shadingMode = DepthMode::Less;
 
-            Vertex transformedVertex = vertexShader(vertex, uniform);
-            transformedVertices.push_back(transformedVertex);
+    if (depthPrepass) {
+        for (int index : tileBins.bins[tile]) {
+            const BinnedTriangle& binned = tileBins.triangles[index];
+            triangle(binned.a, binned.b, binned.c, rect, DepthMode::DepthOnly, [](Fragment&) {});
         }
+        shadingMode = DepthMode::Equal;
+    }
 
-        // 2. Primitive Assembly
-        // transformedVertices -> triangles
-        std::vector<std::vector<Vertex>> triangles = primitiveAssembly(transformedVertices);
-
-
-        // 3. Rasterize
-        // triangles -> Fragments
-        std::vector<Fragment> fragments;
-        for (const std::vector<Vertex>& triangleVertices : triangles) {
-            std::vector<Fragment> rasterizedTriangle = triangle(
-                    triangleVertices[0],
-                    triangleVertices[1],
-                    triangleVertices[2]
-            );
-            fragments.insert(
-                    fragments.end(),
-                    rasterizedTriangle.begin(),
-                    rasterizedTriangle.end()
-            );
+    StampWriter writer;
+    for (int index : tileBins.bins[tile]) {
+        const BinnedTriangle& binned = tileBins.triangles[index];
+        Shader shader = drawStates[binned.draw].shader;
+        float seed = instanceSeed(binned);
+
+        triangle(binned.a, binned.b, binned.c, rect, shadingMode, [&writer, shader, seed](Fragment& fragment) {
+            fragment.seed = seed;
+            writer.write(shadeFragment(shader, fragment));
+        });
+    }
+    writer.flush();
+}
+
+// Rasterizes only depth and (draw, triangle, barycentrics) per pixel, then runs one fragment
+// shader per visible pixel, grouped by shader
+void rasterizeVisibility(int tile) {
+    if (tileBins.bins[tile].empty())
+        return;
+
+    TileRect rect = tileRect(tile);
+    prepareDepth(rect);
+    clearVisibility(rect);
+
+    for (int index : tileBins.bins[tile]) {
+        const BinnedTriangle& binned = tileBins.triangles[index];
+        rasterizeStamps(binned.a, binned.b, binned.c, rect, DepthMode::Less, 1, [&](const PixelStamp& pixels, int lane, int x, int y) {
+            visibilityAt(x, y) = VisibilitySample{binned.draw, index, pixels.v[lane], pixels.u[lane]};
+        });
+    }
+
+    thread_local ShadingQueues queues(SHADER_COUNT);
+    queues.reset();
+
+    for (int y = rect.minY; y <= rect.maxY; ++y) {
+        for (int x = rect.minX; x <= rect.maxX; ++x) {
+            int draw = visibilityAt(x, y).draw;
+            if (draw >= 0) {
+                queues.pixels[static_cast<int>(drawStates[draw].shader)].push_back(glm::ivec2(x, y));
+            }
         }
+    }
+
+    StampWriter writer;
+    for (int shader = 0; shader < SHADER_COUNT; ++shader) {
+        StampSetup stamp;
+        int cachedTriangle = -1;
+        float seed = 0.0f;
+
+        for (const glm::ivec2& p : queues.pixels[shader]) {
+            const VisibilitySample& sample = visibilityAt(p.x, p.y);
+
+            // Neighbouring pixels usually share a triangle, so its attributes are set up once
+            if (sample.triangle != cachedTriangle) {
+                const BinnedTriangle& binned = tileBins.triangles[sample.triangle];
+                setupChannels(stamp, binned.a, binned.b, binned.c);
+                seed = instanceSeed(binned);
+                cachedTriangle = sample.triangle;
+            }
 
+            Fragment fragment = interpolateFragment(stamp, p.x, p.y, sample.v, sample.u);
+            fragment.seed = seed;
+            writer.write(shadeFragment(static_cast<Shader>(shader), fragment));
+        }
+    }
+    writer.flush();
+}
 
-        // 4. Fragment Shader
-        for (Fragment fragment : fragments) {
-            switch (model.shader) {
-                case Shader::Earth:
-                    point(fragmentShaderEarth5(fragment));
-                    break;
-                case Shader::Sun:
-                    point(fragmentShaderSun(fragment));
-                    break;
-                case Shader::Jupiter:
-                    point(fragmentShaderJupiter(fragment));
-                    break;
-                case Shader::Uranus:
-                    point(fragmentShaderUranusRevised(fragment));
-                    break;
-                case Shader::Mars:
-                    point(fragmentShaderMars(fragment));
-                    break;
-                case Shader::Neptune:
-                    point(fragmentShaderNeptune(fragment));
-                    break;
-                case Shader::Noise:
-                    point(noiseFragmentShader(fragment));
-                    break;
-                case Shader::Ship:
-                    point(shipFragmentShader(fragment));
-                    break;
-                case Shader::ShipMoving:
-                    point(shipFragmentShaderMoving(fragment));
-                    break;
-                default:
-                    point(fragmentShader(fragment));
-                    break;
+// Keeps the previous frame and clears only the dirty tiles, with their depth and the
+// stars that fall inside them
+void clearDirtyTiles() {
+    Pixel background = packColor(clearColor);
+    for (int tile : dirtyTiles.tiles) {
+        TileRect rect = tileRect(tile);
+        for (int y = rect.minY; y <= rect.maxY; ++y) {
+            for (int x = rect.minX; x <= rect.maxX; ++x) {
+                colorAt(x, y) = background;
+            }
+        }
+        for (int ty = rect.minY / DEPTH_TILE_SIZE; ty <= rect.maxY / DEPTH_TILE_SIZE; ++ty) {
+            for (int tx = rect.minX / DEPTH_TILE_SIZE; tx <= rect.maxX / DEPTH_TILE_SIZE; ++tx) {
+                invalidateDepthTile(tx, ty);
             }
         }
     }
+
+    drawStars([](int x, int y) { return dirtyTiles.contains(x, y); });
 }
 
-std::vector<glm::vec3> setupVertexFromObject(const std::vector<Face>& faces, const std::vector<glm::vec3>& vertices, const std::vector<glm::vec3>& normals, const std::vector<glm::vec3>& texCoords){
-    std::vector<glm::vec3> vertexBufferObject;
+// Post-transform vertices of the mesh being drawn. Triangles are copied into the bins, so
+// the buffer is reused by the next mesh.
+std::vector<Vertex> transformedVertices;
+
+// Vertex stage and primitive assembly of a mesh drawn once, binned under draw
+void submitMesh(int draw, const Model& model, const DrawUniforms& uniforms, const glm::mat4& viewport) {
+    // 1. Vertex Shader
+    // vertex -> transformedVertices, once per unique vertex of the mesh
+    transformedVertices.resize(model.mesh->vertexCount());
+    vertexKernel(*model.mesh, uniforms, transformedVertices.data());
+
+    // 2. Primitive Assembly
+    // transformedVertices + indices -> triangles, binned into the screen tiles they overlap
+    primitiveAssembly(transformedVertices.data(), model.mesh->indices, viewport, model.cullMode, [&](const Vertex& a, const Vertex& b, const Vertex& c) {
+        tileBins.add(draw, -1, a, b, c);
+    });
+}
+
+// Instanced draws split their instances into ranges of INSTANCES_PER_JOB, and the tile
+// workers run the vertex stage and primitive assembly of one range per job. Every job
+// keeps its own triangles; they are binned afterwards in instance order, so the bins do
+// not depend on which worker ran which range.
+const int INSTANCES_PER_JOB = 256;
+
+struct InstanceJob {
+    std::vector<Vertex> vertices;
+    std::vector<BinnedTriangle> triangles;
+    std::vector<TileRect> pixels;
+};
+std::vector<InstanceJob> instanceJobs;
+
+void submitInstances(int draw, const Model& model, const DrawUniforms& uniforms, const glm::mat4& viewport) {
+    const std::vector<Instance>& instances = *model.instances;
+    int instanceCount = static_cast<int>(instances.size());
+    int jobCount = (instanceCount + INSTANCES_PER_JOB - 1) / INSTANCES_PER_JOB;
+    if (static_cast<int>(instanceJobs.size()) < jobCount) {
+        instanceJobs.resize(jobCount);
+    }
+
+    tileWorkers().run(jobCount, [&](int j) {
+        InstanceJob& job = instanceJobs[j];
+        int first = j * INSTANCES_PER_JOB;
+        int count = std::min(INSTANCES_PER_JOB, instanceCount - first);
+        size_t vertexCount = model.mesh->vertexCount();
+
+        // 1. Vertex Shader, the mesh streamed once per group of instances
+        job.vertices.resize(count * vertexCount);
+        instanceKernel(*model.mesh, uniforms, &instances[first], count, job.vertices.data());
+
+        // 2. Primitive Assembly, one instance at a time
+        job.triangles.clear();
+        job.pixels.clear();
+        for (int k = 0; k < count; ++k) {
+            primitiveAssembly(&job.vertices[k * vertexCount], model.mesh->indices, viewport, model.cullMode, [&](const Vertex& a, const Vertex& b, const Vertex& c) {
+                TileRect pixels;
+                if (pixelBounds(a, b, c, pixels)) {
+                    job.triangles.push_back(BinnedTriangle{draw, first + k, a, b, c});
+                    job.pixels.push_back(pixels);
+                }
+            });
+        }
+    });
 
-    for (const auto& face : faces)
-    {
-        for (int i = 0; i < 3; ++i)
-        {
-            // Get the vertex position
-            glm::vec3 vertexPosition = vertices[face.vertexIndices[i]];
+    for (int j = 0; j < jobCount; ++j) {
+        const InstanceJob& job = instanceJobs[j];
+        for (size_t t = 0; t < job.triangles.size(); ++t) {
+            tileBins.insert(job.triangles[t], job.pixels[t]);
+        }
+    }
+}
 
-            // Get the normal for the current vertex
-            glm::vec3 vertexNormal = normals[face.normalIndices[i]];
+void render(const FrameUniforms& frame, const std::vector<Model>& scene) {
+    tileBins.reset();
+    drawStates.clear();
 
-            // Get the texture for the current vertex
-            glm::vec3 vertexTexture = texCoords[face.texIndices[i]];
+    for (int draw = 0; draw < scene.size(); ++draw) {
+        const Model& model = scene[draw];
+        DrawUniforms uniforms = createDrawUniforms(model.modelMatrix, frame);
 
-            // Add the vertex position and normal to the vertex array
-            vertexBufferObject.push_back(vertexPosition);
-            vertexBufferObject.push_back(vertexNormal);
-            vertexBufferObject.push_back(vertexTexture);
+        // Instances all belong to one draw, so they share its shader and its dirty-tile bounds
+        if (model.instances) {
+            submitInstances(draw, model, uniforms, frame.viewport);
+        } else {
+            submitMesh(draw, model, uniforms, frame.viewport);
         }
+
+        drawStates.push_back(DrawState{uniforms, frame.viewport, model.shader, model.cullMode, model.mesh.get(), model.instances, emptyRect});
     }
 
-    return vertexBufferObject;
+    tileBins.drawBounds.resize(drawStates.size(), emptyRect);
+    for (size_t draw = 0; draw < drawStates.size(); ++draw) {
+        drawStates[draw].bounds = tileBins.drawBounds[draw];
+    }
+
+    if (fullRedraw || !hasPreviousFrame) {
+        dirtyTiles.invalidate();
+    }
+    dirtyTiles.update(drawStates);
+    if (dirtyTiles.full) {
+        clear();
+    } else {
+        clearDirtyTiles();
+    }
+
+    // 3. Rasterize + 4. Fragment Shader
+    // Every tile is owned by one worker, which rasterizes its bin in submission order
+    int dirtyCount = static_cast<int>(dirtyTiles.tiles.size());
+    if (renderMode == RenderMode::Visibility) {
+        tileWorkers().run(dirtyCount, [](int i) { rasterizeVisibility(dirtyTiles.tiles[i]); });
+    } else {
+        tileWorkers().run(dirtyCount, [](int i) { rasterizeForward(dirtyTiles.tiles[i]); });
+    }
+
+    hasPreviousFrame = true;
 }
 
-std::vector<Model> c_update(std::vector<Model>& mToUpdate, Camera newCamera) {
-    for (auto& model : mToUpdate) {
-        model.uniforms.view = createViewMatrix(newCamera);
+// Asteroid belt between the orbits of Mars and Jupiter: one instance per asteroid, each
+// with its own radius, height, size, tumble and noise seed. The layout is fixed, so the
+// buffer is built once and the whole belt turns through its model matrix.
+InstanceBuffer createAsteroidBelt(int count) {
+    std::mt19937 random(21242);
+    std::uniform_real_distribution<float> orbit(marsDistanceToSun + 0.4f, jupiterDistanceToSun - 0.4f);
+    std::uniform_real_distribution<float> height(-0.15f, 0.15f);
+    std::uniform_real_distribution<float> size(0.015f, 0.05f);
+    std::uniform_real_distribution<float> angle(0.0f, 360.0f);
+    std::uniform_real_distribution<float> axis(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> seed(0.0f, 100.0f);
+
+    auto instances = std::make_shared<std::vector<Instance>>();
+    instances->reserve(count);
+    for (int i = 0; i < count; ++i) {
+        float radius = orbit(random);
+        float position = glm::radians(angle(random));
+        glm::vec3 translation(radius * cos(position), height(random), radius * sin(position));
+        glm::vec3 rotationAxis{axis(random), axis(random), axis(random)};
+        if (glm::dot(rotationAxis, rotationAxis) < 1e-4f) {
+            rotationAxis = glm::vec3(0.0f, 1.0f, 0.0f);
+        }
+        float scale = size(random);
+        glm::mat4 transform = createModelMatrix(translation, glm::vec3(scale), glm::normalize(rotationAxis), angle(random));
+        instances->push_back(createInstance(transform, seed(random)));
     }
-    return mToUpdate;
+    return instances;
 }
 
-Model createModel(std::vector<glm::vec3> vertices, Uniforms uniforms, Shader shader) {
+Model createModel(MeshHandle mesh, Shader shader, CullMode cullMode = CullMode::Back) {
     Model model;
-    model.vertices = vertices;
-    model.uniforms = uniforms;
+    model.mesh = std::move(mesh);
     model.shader = shader;
+    model.cullMode = cullMode;
     return model;
 }
 
+// Command line options:
+//   --simd scalar|sse4.1|avx2   force the rasterizer, color packing and vertex kernels (only levels the CPU supports)
+//   --depth-prepass             rasterize depth for every tile before shading (heavy overdraw)
+//   --visibility-buffer         rasterize a visibility buffer and shade every visible pixel once
+//   --layout linear|tiled|morton  storage order of the color and depth buffers
+//   --buffers 1|2|3             frames in flight: 1 renders and presents in turn, 2 or 3 render on a thread
+//   --size <width>x<height>     render target and initial window size (default 1280x720)
+//   --asteroids <count>         add an instanced asteroid belt between Mars and Jupiter
+//   --full-redraw               draw the whole frame every frame instead of only the tiles that changed
+//   --dynamic-resolution <ms>   scale the render resolution to keep render time under <ms>
+//   --headless                  render without a window, writing every frame to disk
+//   --output <pattern>          file names for headless frames (default frame_%04d.ppm)
+//   --frames <count>            stop after <count> frames (headless default: 1)
+//   --pacing fixed|vsync|uncapped  frame pacing (default fixed, uncapped when headless)
+//   --fps <rate>                frame rate for fixed pacing (default 60)
+bool parseArguments(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+
+        if (arg == "--simd" && i + 1 < argc) {
+            SimdLevel requested;
+            if (!parseSimdLevel(argv[++i], requested)) {
+                std::cerr << "Error: Unknown SIMD level: " << argv[i] << std::endl;
+                return false;
+            }
+            if (requested > simdLevel) {
+                std::cerr << "Warning: CPU does not support " << simdLevelName(requested) << ", using " << simdLevelName(simdLevel) << std::endl;
+            } else {
+                simdLevel = requested;
+            }
+            stampKernel = selectStampKernel(simdLevel);
+            packKernel = selectPackKernel(simdLevel);
+            vertexKernel = selectVertexKernel(simdLevel);
+            instanceKernel = selectInstanceKernel(simdLevel);
+        } else if (arg == "--depth-prepass") {
+            depthPrepass = true;
+        } else if (arg == "--visibility-buffer") {
+            renderMode = RenderMode::Visibility;
+        } else if (arg == "--layout" && i + 1 < argc) {
+            if (!parseBufferLayout(argv[++i], bufferLayout)) {
+                std::cerr << "Error: Unknown buffer layout: " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (arg == "--buffers" && i + 1 < argc) {
+            framesInFlight = std::atoi(argv[++i]);
+            if (framesInFlight < 1 || framesInFlight > MAX_FRAMES_IN_FLIGHT) {
+                std::cerr << "Error: --buffers must be between 1 and " << MAX_FRAMES_IN_FLIGHT << std::endl;
+                return false;
+            }
+        } else if (arg == "--asteroids" && i + 1 < argc) {
+            asteroidCount = std::atoi(argv[++i]);
+            if (asteroidCount < 0) {
+                std::cerr << "Error: Invalid asteroid count: " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (arg == "--full-redraw") {
+            fullRedraw = true;
+        } else if (arg == "--dynamic-resolution" && i + 1 < argc) {
+            dynamicResolution = true;
+            resolution.targetMs = std::strtof(argv[++i], nullptr);
+            if (!(resolution.targetMs > 0.0f)) {
+                std::cerr << "Error: Invalid frame time budget: " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (arg == "--headless") {
+            headless = true;
+        } else if (arg == "--output" && i + 1 < argc) {
+            outputPattern = argv[++i];
+            if (!isFramePattern(outputPattern)) {
+                std::cerr << "Error: --output needs exactly one integer conversion for the frame number (e.g. frame_%04d.ppm), and '%%' for a literal '%': " << outputPattern << std::endl;
+                return false;
+            }
+        } else if (arg == "--frames" && i + 1 < argc) {
+            frameLimit = std::atoi(argv[++i]);
+            if (frameLimit <= 0) {
+                std::cerr << "Error: Invalid frame count: " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (arg == "--pacing" && i + 1 < argc) {
+            if (!parsePacingMode(argv[++i], pacingMode)) {
+                std::cerr << "Error: Unknown pacing mode: " << argv[i] << std::endl;
+                return false;
+            }
+            pacingModeSet = true;
+        } else if (arg == "--fps" && i + 1 < argc) {
+            targetFps = std::strtod(argv[++i], nullptr);
+            if (!(targetFps > 0.0)) {
+                std::cerr << "Error: Invalid frame rate: " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (arg == "--size" && i + 1 < argc) {
+            int width = 0, height = 0;
+            char separator = 0;
+            std::istringstream size(argv[++i]);
+            if (!(size >> width >> separator >> height) || separator != 'x' || width <= 0 || height <= 0) {
+                std::cerr << "Error: Invalid size: " << argv[i] << std::endl;
+                return false;
+            }
+            screenWidth = width;
+            screenHeight = height;
+        } else {
+            std::cerr << "Error: Unknown argument: " << arg << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Shows a finished frame. Dynamic resolution adjusts the render size from its render time.
+ResolvedFrame resolvedFrame; // the frame being presented when nothing renders ahead
+void presentFrame(FrameSink& sink, const ResolvedFrame& frame) {
+    sink.upload(frame);
+    sink.flip();
+
+    if (dynamicResolution && resolution.update(frame.renderMs)) {
+        updateRenderSize();
+    }
+}
+
+// Stops rendering and closes the sink and the window when main returns, whichever way
+// it returns. Runs before sink is destroyed.
+struct Shutdown {
+    FrameSink* sink = nullptr;
+
+    ~Shutdown() {
+        renderThread.stop();
+        sink->close();
+#ifndef NO_SDL
+        if (!headless) {
+            closeWindow();
+        }
+#endif
+    }
+};
+
 int main(int argc, char** argv) {
+    if (!parseArguments(argc, argv)) {
+        return 1;
+    }
+
     if (!init()) {
         return 1;
     }
+    windowWidth = screenWidth;
+    windowHeight = screenHeight;
+
+    std::unique_ptr<FrameSink> sink;
+#ifndef NO_SDL
+    if (!headless) {
+        // The texture is created at the render size; stretch it to the window smoothly
+        if (dynamicResolution) {
+            SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear");
+        }
+        sink = std::make_unique<WindowSink>(pacingMode == PacingMode::VSync);
+    }
+#endif
+    if (headless) {
+        sink = std::make_unique<ImageSink>(outputPattern, windowWidth, windowHeight);
+        if (frameLimit == 0) {
+            frameLimit = 1;
+        }
+        if (!pacingModeSet) {
+            pacingMode = PacingMode::Uncapped;
+        }
+    }
 
-    Camera camera = setupInitialCamera();
+    // From here on every return from main goes through shutdown, which runs before sink
+    // is destroyed. close() also cleans up after an open() that failed halfway.
+    Shutdown shutdown;
+    shutdown.sink = sink.get();
+    if (!sink->open()) {
+        return 1;
+    }
+    if (framesInFlight > 1) {
+        renderThread.start(framesInFlight);
+    }
 
-    std::vector<glm::vec3> planetVertices, planetNormals, planetTexCoords, shipVertices, shipNormals, shipTexCoords;
-    std::vector<Face> planetFaces, shipFaces;
+    Camera camera = setupInitialCamera();
 
-    // Load the OBJ file
-    bool success1 = loadOBJ("../model/sphere.obj", planetVertices, planetFaces, planetNormals, planetTexCoords);
-    bool success2 = loadOBJ("../model/naveEspacial.obj", shipVertices, shipFaces, shipNormals, shipTexCoords);
-    if (!success1 || !success2) {
+    // Load the OBJ files; every planet draws the same sphere
+    MeshRegistry meshes;
+    MeshHandle planetMesh = meshes.load("../model/sphere.obj");
+    MeshHandle shipMesh = meshes.load("../model/naveEspacial.obj");
+    if (!planetMesh || !shipMesh) {
         std::cerr << "Error loading OBJ file!" << std::endl;
         return 1;
     }
 
+    FramePacer pacer;
+    FrameRateCounter frameRate; // For calculating the frames per second
+    int frameCount = 0;
 
-    // OBJ into VBO
-    std::vector<glm::vec3> planetVBO = setupVertexFromObject(planetFaces, planetVertices, planetNormals, planetTexCoords);
-    std::vector<glm::vec3> shipVBO = setupVertexFromObject(shipFaces, shipVertices, shipNormals, shipTexCoords);
-
-    Uint32 frameStart, frameTime; // For calculating the frames per second
-
-    Uniforms shipUniform = planetBaseUniform(camera);
     float shipScale = 0.05f;
     glm::vec3 shipTranslationVector(0.0f, 0.4f, 13.5f);
     glm::vec3 shipRotationAxis(0.0f, 1.0f, 1.5f);
     glm::vec3 shipScaleFactor(shipScale, shipScale, shipScale);
-    Model shipModel = createModel(shipVBO, shipUniform, Shader::Ship);
+    Model shipModel = createModel(shipMesh, Shader::Ship, CullMode::None); // the ship mesh has mixed winding
 
-    Uniforms sunUniform = planetBaseUniform(camera);
     float sunScale = 3.0f;
     glm::vec3 sunTranslationVector(0.0f, 0.0f, 0.0f);
     glm::vec3 sunRotationAxis(0.0f, 1.0f, 0.0f);
     glm::vec3 sunScaleFactor(sunScale, sunScale, sunScale);
-    Model sunModel = createModel(planetVBO, sunUniform, Shader::Sun);
+    Model sunModel = createModel(planetMesh, Shader::Sun);
 
-    Uniforms earthUniform = planetBaseUniform(camera);
     float earthScale = 0.5f;
     glm::vec3 earthRotationAxis(0.0f, 1.0f, 0.0f);
     glm::vec3 earthScaleFactor(earthScale, earthScale, earthScale);
-    Model earthModel = createModel(planetVBO, earthUniform, Shader::Earth);
+    Model earthModel = createModel(planetMesh, Shader::Earth);
 
-    Uniforms jupiterUniform = planetBaseUniform(camera);
     float jupiterScale = 0.7f;
     glm::vec3 jupiterRotationAxis(0.0f, 1.0f, 0.0f);
     glm::vec3 jupiterScaleFactor(jupiterScale, jupiterScale, jupiterScale);
-    Model jupiterModel = createModel(planetVBO, jupiterUniform, Shader::Jupiter);
+    Model jupiterModel = createModel(planetMesh, Shader::Jupiter);
 
-    Uniforms uranusUniform = planetBaseUniform(camera);
     float uranusScale = 0.6f;
     glm::vec3 uranusRotationAxis(0.0f, 1.0f, 0.0f); // Rotate around the Y-axis every model
     glm::vec3 uranusScaleFactor(uranusScale, uranusScale, uranusScale);  // Scale of the model
-    Model uranusModel = createModel(planetVBO, uranusUniform, Shader::Uranus);
+    Model uranusModel = createModel(planetMesh, Shader::Uranus);
 
-    Uniforms marsUniform = planetBaseUniform(camera);
     float marsScale = 0.4f;
     glm::vec3 marsRotationAxis(0.0f, 1.0f, 0.0f); // Rotate around the Y-axis every model
     glm::vec3 marsScaleFactor(marsScale, marsScale, marsScale);  // Scale of the model
-    Model marsModel = createModel(planetVBO, marsUniform, Shader::Mars);
+    Model marsModel = createModel(planetMesh, Shader::Mars);
 
-    Uniforms neptuneUniform = planetBaseUniform(camera);
     float neptuneScale = 0.6f;
     glm::vec3 neptuneRotationAxis(0.0f, 1.0f, 0.0f); // Rotate around the Y-axis every model
     glm::vec3 neptuneScaleFactor(neptuneScale, neptuneScale, neptuneScale);  // Scale of the model
-    Model neptuneModel = createModel(planetVBO, neptuneUniform, Shader::Neptune);
+    Model neptuneModel = createModel(planetMesh, Shader::Neptune);
+
+    // Every asteroid is an instance of the same icosahedron, drawn by a single model
+    Model beltModel = createModel(meshes.add("icosahedron", createIcosahedronMesh()), Shader::Noise);
+    beltModel.instances = createAsteroidBelt(asteroidCount);
+    glm::vec3 beltRotationAxis(0.0f, 1.0f, 0.0f);
+    float beltAngle = 0.0f;
 
+    cout << "Rasterizador: " << simdLevelName(simdLevel) << endl;
     cout << "Empieza el renderizado" << endl;
 
     bool running = true;
     bool orbiting = true;
 
+    pacer.start(targetFps);
+    auto runStart = std::chrono::steady_clock::now();
+
     while (running) {
-        frameStart = SDL_GetTicks();
-        SDL_Event event;
-        while (SDL_PollEvent(&event)) {
-            if (event.type == SDL_QUIT) {
-                running = false;
-            }
+#ifndef NO_SDL
+        if (!headless) {
+            SDL_Event event;
+            while (SDL_PollEvent(&event)) {
+                if (event.type == SDL_QUIT) {
+                    running = false;
+                }
 
-            if (event.type == SDL_KEYDOWN) {
-                switch (event.key.keysym.sym) {
-                    case SDLK_w:
-                    case SDLK_a:
-                    case SDLK_s:
-                    case SDLK_d:
-                        shipMoving = true;
-                        break;
+                if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+                    windowWidth = event.window.data1;
+                    windowHeight = event.window.data2;
+                    updateRenderSize();
                 }
-            }
 
-            if (event.type == SDL_KEYUP) {
-                switch (event.key.keysym.sym) {
-                    case SDLK_w:
-                    case SDLK_a:
-                    case SDLK_s:
-                    case SDLK_d:
-                        shipMoving = false;
-                        break;
+                if (event.type == SDL_KEYDOWN) {
+                    switch (event.key.keysym.sym) {
+                        case SDLK_w:
+                        case SDLK_a:
+                        case SDLK_s:
+                        case SDLK_d:
+                            shipMoving = true;
+                            break;
+                    }
+                }
+
+                if (event.type == SDL_KEYUP) {
+                    switch (event.key.keysym.sym) {
+                        case SDLK_w:
+                        case SDLK_a:
+                        case SDLK_s:
+                        case SDLK_d:
+                            shipMoving = false;
+                            break;
+                    }
                 }
-            }
 
 
-            if (event.type == SDL_KEYDOWN) {
-                float increment = 0.5f;
-                switch (event.key.keysym.sym) {
-                    case SDLK_ESCAPE:
-                        running = false;
-                        break;
-                    case SDLK_w:
-                        camera = zoomIn(camera);
-                        break;
-                    case SDLK_s:
-                        camera = zoomOut(camera);
-                        break;
-                    case SDLK_a:
-                        camera = moveLeft(camera);
-                        break;
-                    case SDLK_d:
-                        camera = moveRight(camera);
-                        break;
-                    case SDLK_LEFT:
-                        rsPlanets -= increment;
-                        osPlanets -= increment;
-
-                        break;
-                    case SDLK_RIGHT:
-                        rsPlanets += increment;
-                        osPlanets += increment;
-
-                        break;
-                    case SDLK_p:
-                        orbiting = !orbiting;
-                        break;
+                if (event.type == SDL_KEYDOWN) {
+                    float increment = 0.5f;
+                    switch (event.key.keysym.sym) {
+                        case SDLK_ESCAPE:
+                            running = false;
+                            break;
+                        case SDLK_w:
+                            camera = zoomIn(camera);
+                            break;
+                        case SDLK_s:
+                            camera = zoomOut(camera);
+                            break;
+                        case SDLK_a:
+                            camera = moveLeft(camera);
+                            break;
+                        case SDLK_d:
+                            camera = moveRight(camera);
+                            break;
+                        case SDLK_LEFT:
+                            rsPlanets -= increment;
+                            osPlanets -= increment;
+
+                            break;
+                        case SDLK_RIGHT:
+                            rsPlanets += increment;
+                            osPlanets += increment;
+
+                            break;
+                        case SDLK_p:
+                            orbiting = !orbiting;
+                            break;
+                    }
                 }
             }
         }
+#endif
 
 
         raSun += rsPlanets * 0.2f;
@@ -313,14 +728,13 @@ int main(int argc, char** argv) {
             oaJupiter += 0.6f * osPlanets;
             oaUranus += 0.4f * osPlanets;
             oaNeptune += 0.3f * osPlanets;
+            beltAngle += 0.5f * osPlanets;
         }
 
-        shipUniform.model = createShipModelMatrix(shipTranslationVector, shipScaleFactor);
-        shipModel.modelMatrix = shipUniform.model;
+        shipModel.modelMatrix = createShipModelMatrix(shipTranslationVector, shipScaleFactor);
 
 
-        sunUniform.model = createModelMatrix(sunTranslationVector, sunScaleFactor, sunRotationAxis, raSun);
-        sunModel.modelMatrix = sunUniform.model;
+        sunModel.modelMatrix = createModelMatrix(sunTranslationVector, sunScaleFactor, sunRotationAxis, raSun);
 
         models.push_back(sunModel);
 
@@ -329,8 +743,7 @@ int main(int argc, char** argv) {
                 0.0f,
                 earthDistanceToSun * sin(glm::radians(oaEarth))
         );
-        earthUniform.model = createModelMatrix(earthTranslationVector, earthScaleFactor, earthRotationAxis, raEarth);
-        earthModel.modelMatrix = earthUniform.model;
+        earthModel.modelMatrix = createModelMatrix(earthTranslationVector, earthScaleFactor, earthRotationAxis, raEarth);
 
         models.push_back(earthModel);
 
@@ -341,8 +754,7 @@ int main(int argc, char** argv) {
                 0.0f,
                 marsDistanceToSun * sin(glm::radians(orMars))
         );
-        marsUniform.model = createModelMatrix(marsTranslationVector, marsScaleFactor, marsRotationAxis, raMars);
-        marsModel.modelMatrix = marsUniform.model;
+        marsModel.modelMatrix = createModelMatrix(marsTranslationVector, marsScaleFactor, marsRotationAxis, raMars);
 
         models.push_back(marsModel);
 
@@ -352,8 +764,7 @@ int main(int argc, char** argv) {
                 0.0f,
                 jupiterDistanceToSun * sin(glm::radians(oaJupiter))
         );
-        jupiterUniform.model = createModelMatrix(jupiterTranslationVector, jupiterScaleFactor, jupiterRotationAxis, raJupiter);
-        jupiterModel.modelMatrix = jupiterUniform.model;
+        jupiterModel.modelMatrix = createModelMatrix(jupiterTranslationVector, jupiterScaleFactor, jupiterRotationAxis, raJupiter);
 
         models.push_back(jupiterModel);
 
@@ -362,8 +773,7 @@ int main(int argc, char** argv) {
                 0.0f,
                 uranusDistanceToSun * sin(glm::radians(oaUranus))
         );
-        uranusUniform.model = createModelMatrix(uranusTranslationVector, uranusScaleFactor, uranusRotationAxis, raUranus);
-        uranusModel.modelMatrix = uranusUniform.model;
+        uranusModel.modelMatrix = createModelMatrix(uranusTranslationVector, uranusScaleFactor, uranusRotationAxis, raUranus);
 
         models.push_back(uranusModel);
 
@@ -372,14 +782,14 @@ int main(int argc, char** argv) {
                 0.0f,
                 neptuneDistanceToSun * sin(glm::radians(oaNeptune))
         );
-        neptuneUniform.model = createModelMatrix(nepTranslationVector, neptuneScaleFactor, neptuneRotationAxis, raNeptune);
-        neptuneModel.modelMatrix = neptuneUniform.model;
+        neptuneModel.modelMatrix = createModelMatrix(nepTranslationVector, neptuneScaleFactor, neptuneRotationAxis, raNeptune);
 
         models.push_back(neptuneModel);
 
-        clear();
-
-        models = c_update(models, camera);
+        if (asteroidCount > 0) {
+            beltModel.modelMatrix = createModelMatrix(glm::vec3(0.0f), glm::vec3(1.0f), beltRotationAxis, beltAngle);
+            models.push_back(beltModel);
+        }
 
         models.push_back(shipModel);
 
@@ -390,29 +800,66 @@ int main(int argc, char** argv) {
         }
 
 
-        render();
-
+        // The job owns a copy of the scene, so the next frame can be built while it renders
+        FrameUniforms frame = createFrameUniforms(camera, screenWidth, screenHeight);
+        auto job = [frame, scene = models, starsMoved = orbiting] {
+            // The starfield moves with the orbits, so every tile changes
+            if (starsMoved) {
+                advanceStars();
+                dirtyTiles.invalidate();
+            }
+            render(frame, scene);
+        };
         models.clear();
 
-        // Present the frame buffer to the screen
-        SDL_RenderPresent(renderer);
+        // Present the frame to the screen: the oldest one in flight once the ring is full,
+        // which overlaps with the render thread drawing the newer ones
+        if (framesInFlight > 1) {
+            renderThread.submit(job);
+            if (renderThread.inFlight() == framesInFlight) {
+                presentFrame(*sink, renderThread.next());
+                renderThread.release();
+            }
+        } else {
+            auto renderStart = std::chrono::steady_clock::now();
+            job();
+            std::chrono::duration<float, std::milli> renderTime = std::chrono::steady_clock::now() - renderStart;
+            resolveFrame(*framebuffer, resolvedFrame);
+            resolvedFrame.renderMs = renderTime.count();
+            presentFrame(*sink, resolvedFrame);
+        }
 
-        // Delay to limit the frame rate
-        SDL_Delay(1000 / 60);
+        ++frameCount;
+        if (frameLimit > 0 && frameCount >= frameLimit) {
+            running = false;
+        }
 
-        frameTime = SDL_GetTicks() - frameStart;
+        // Wait for the next frame deadline to limit the frame rate
+        if (pacingMode == PacingMode::Fixed) {
+            pacer.wait();
+        }
 
         // Calculate frames per second and update window title
-        if (frameTime > 0) {
+        if (frameRate.frame() && !headless) {
+#ifndef NO_SDL
             std::ostringstream titleStream;
-            titleStream << "Proyecto 1 | Alejandro Azurdia 21242 \t" + planet + " FPS: " << 1000.0 / frameTime;  // Milliseconds to seconds
+            titleStream << "Proyecto 1 | Alejandro Azurdia 21242 \t" + planet + " FPS: " << frameRate.fps();
+            if (dynamicResolution) {
+                titleStream << " Escala: " << screenWidth << "x" << screenHeight;
+            }
             SDL_SetWindowTitle(window, titleStream.str().c_str());
+#endif
         }
     }
 
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(window);
-    SDL_Quit();
+    // Frames still in flight are shown too, so headless runs write every frame
+    while (renderThread.inFlight() > 0) {
+        presentFrame(*sink, renderThread.next());
+        renderThread.release();
+    }
+
+    std::chrono::duration<double> runTime = std::chrono::steady_clock::now() - runStart;
+    cout << frameCount << " frames, " << frameCount / runTime.count() << " FPS promedio" << endl;
 
     return 0;
 }
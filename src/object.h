@@ -3,7 +3,15 @@
 #include <vector>
 #include <iostream>
 #include <fstream>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
 #include "gl.h"
+#include "shaders.h"
 
 enum class Shader {
     Earth,
@@ -17,12 +25,68 @@ enum class Shader {
     ShipMoving,
 };
 
+const int SHADER_COUNT = static_cast<int>(Shader::ShipMoving) + 1;
+
+// Indexed mesh: the attributes of every unique vertex, and three vertex numbers per triangle.
+// Positions and normals are stored as one stream per component (structure of arrays) so the
+// vertex stage loads eight vertices per instruction. Built once when the mesh is loaded and
+// never modified after.
+struct Mesh {
+    std::vector<float> positionX, positionY, positionZ;
+    std::vector<float> normalX, normalY, normalZ;
+    std::vector<glm::vec3> texCoords;
+    std::vector<std::uint32_t> indices;
+
+    size_t vertexCount() const {
+        return positionX.size();
+    }
+
+    void addVertex(const glm::vec3& position, const glm::vec3& normal, const glm::vec3& tex) {
+        positionX.push_back(position.x);
+        positionY.push_back(position.y);
+        positionZ.push_back(position.z);
+        normalX.push_back(normal.x);
+        normalY.push_back(normal.y);
+        normalZ.push_back(normal.z);
+        texCoords.push_back(tex);
+    }
+
+    Vertex vertex(size_t i) const {
+        return Vertex{
+                glm::vec3(positionX[i], positionY[i], positionZ[i]),
+                glm::vec3(normalX[i], normalY[i], normalZ[i]),
+                texCoords[i]
+        };
+    }
+};
+
+// Models reference their mesh through a handle, so copying a model (or drawing the same
+// mesh many times) never copies vertices
+using MeshHandle = std::shared_ptr<const Mesh>;
+
+// One copy of an instanced mesh, placed relative to its model's modelMatrix
+struct Instance {
+    glm::mat4 transform;
+    glm::mat3 normal; // inverse transpose of transform's 3x3 part, so drawing needs no inverse
+    float seed;       // shading parameter of this copy: offsets the pattern of Shader::Noise
+};
+
+Instance createInstance(const glm::mat4& transform, float seed) {
+    return Instance{transform, glm::transpose(glm::inverse(glm::mat3(transform))), seed};
+}
+
+// Immutable like meshes: the instances of a draw change by swapping in a new buffer
+using InstanceBuffer = std::shared_ptr<const std::vector<Instance>>;
+
+// Without instances a model draws its mesh once at modelMatrix; with them, once per
+// instance at modelMatrix * instance.transform, all with the same shader
 class Model {
 public:
     glm::mat4 modelMatrix;
-    std::vector<glm::vec3> vertices;
-    Uniforms uniforms;
+    MeshHandle mesh;
+    InstanceBuffer instances;
     Shader shader;
+    CullMode cullMode = CullMode::Back;
 };
 
 
@@ -90,4 +154,87 @@ bool loadOBJ(
     out_faces = faces;
 
     return true;
-}
\ No newline at end of file
+}
+
+// OBJ faces into an indexed mesh. Corners sharing the same position and normal become a
+// single vertex, so the vertex shader runs once for each of them. No stage reads texture
+// coordinates yet, so corners that only differ in theirs are merged as well (keeping the
+// first one); add the texture index to the key once a shader samples them.
+Mesh setupMeshFromObject(const std::vector<Face>& faces, const std::vector<glm::vec3>& vertices, const std::vector<glm::vec3>& normals, const std::vector<glm::vec3>& texCoords){
+    Mesh mesh;
+    mesh.indices.reserve(faces.size() * 3);
+    std::map<std::array<int, 2>, std::uint32_t> uniqueVertices;
+
+    for (const auto& face : faces)
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            std::array<int, 2> key = {face.vertexIndices[i], face.normalIndices[i]};
+            auto [found, inserted] = uniqueVertices.emplace(key, static_cast<std::uint32_t>(mesh.vertexCount()));
+
+            if (inserted) {
+                mesh.addVertex(vertices[face.vertexIndices[i]], normals[face.normalIndices[i]], texCoords[face.texIndices[i]]);
+            }
+            mesh.indices.push_back(found->second);
+        }
+    }
+
+    return mesh;
+}
+
+// Unit icosahedron with smooth normals: 12 vertices, 20 triangles. Cheap enough to draw
+// tens of thousands of times (asteroids, debris).
+Mesh createIcosahedronMesh() {
+    const float t = (1.0f + std::sqrt(5.0f)) / 2.0f;
+    const glm::vec3 corners[12] = {
+            {-1, t, 0}, {1, t, 0}, {-1, -t, 0}, {1, -t, 0},
+            {0, -1, t}, {0, 1, t}, {0, -1, -t}, {0, 1, -t},
+            {t, 0, -1}, {t, 0, 1}, {-t, 0, -1}, {-t, 0, 1}
+    };
+    // Counter-clockwise seen from outside
+    const std::uint32_t triangles[60] = {
+            0, 11, 5, 0, 5, 1, 0, 1, 7, 0, 7, 10, 0, 10, 11,
+            1, 5, 9, 5, 11, 4, 11, 10, 2, 10, 7, 6, 7, 1, 8,
+            3, 9, 4, 3, 4, 2, 3, 2, 6, 3, 6, 8, 3, 8, 9,
+            4, 9, 5, 2, 4, 11, 6, 2, 10, 8, 6, 7, 9, 8, 1
+    };
+
+    Mesh mesh;
+    for (const glm::vec3& corner : corners) {
+        glm::vec3 position = glm::normalize(corner);
+        mesh.addVertex(position, position, glm::vec3(0.0f));
+    }
+    mesh.indices.assign(std::begin(triangles), std::end(triangles));
+    return mesh;
+}
+
+// Every mesh loaded so far, by path (or name). Loading the same OBJ twice returns the same handle.
+class MeshRegistry {
+public:
+    // Returns nullptr if the OBJ file could not be loaded
+    MeshHandle load(const std::string& path) {
+        auto found = meshes.find(path);
+        if (found != meshes.end()) {
+            return found->second;
+        }
+
+        std::vector<glm::vec3> vertices, normals, texCoords;
+        std::vector<Face> faces;
+        if (!loadOBJ(path, vertices, faces, normals, texCoords)) {
+            return nullptr;
+        }
+
+        // OBJ into vertex and index buffers
+        return add(path, setupMeshFromObject(faces, vertices, normals, texCoords));
+    }
+
+    // Registers a mesh built in code under a name, replacing any mesh with that name
+    MeshHandle add(const std::string& name, Mesh mesh) {
+        auto handle = std::make_shared<const Mesh>(std::move(mesh));
+        meshes[name] = handle;
+        return handle;
+    }
+
+private:
+    std::unordered_map<std::string, MeshHandle> meshes;
+};
@@ -0,0 +1,92 @@
+#pragma once
+#include <chrono>
+#include <string>
+#include <thread>
+
+// How the main loop waits between frames
+enum class PacingMode {
+    Fixed,    // sleep until an absolute deadline every 1/fps seconds
+    VSync,    // no sleeping, presenting blocks until the display refreshes
+    Uncapped, // render as fast as possible, to measure throughput
+};
+
+bool parsePacingMode(const std::string& name, PacingMode& mode) {
+    if (name == "fixed") {
+        mode = PacingMode::Fixed;
+    } else if (name == "vsync") {
+        mode = PacingMode::VSync;
+    } else if (name == "uncapped") {
+        mode = PacingMode::Uncapped;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Keeps frames on a fixed grid of deadlines. Every deadline is the previous one plus the
+// frame period, so the time spent rendering is part of the period instead of being added
+// to it. After a stall longer than a frame the grid restarts instead of rushing to catch up.
+class FramePacer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    void start(double fps) {
+        period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / fps));
+        deadline = Clock::now() + period;
+    }
+
+    void wait() {
+        Clock::time_point now = Clock::now();
+        if (now > deadline + period) {
+            deadline = now + period;
+            return;
+        }
+
+        // OS sleeps can overshoot by a scheduler tick, so the last stretch is spent yielding
+        const auto spin = std::chrono::milliseconds(2);
+        if (deadline - now > spin) {
+            std::this_thread::sleep_until(deadline - spin);
+        }
+        while (Clock::now() < deadline) {
+            std::this_thread::yield();
+        }
+        deadline += period;
+    }
+
+private:
+    Clock::duration period{};
+    Clock::time_point deadline{};
+};
+
+// Frame rate over the frames presented since the last report
+class FrameRateCounter {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Returns true about twice a second, when fps() has a new value
+    bool frame() {
+        Clock::time_point now = Clock::now();
+        if (frames++ == 0) {
+            since = now;
+            return false;
+        }
+
+        std::chrono::duration<double> elapsed = now - since;
+        if (elapsed.count() < 0.5) {
+            return false;
+        }
+        rate = (frames - 1) / elapsed.count();
+        frames = 1;
+        since = now;
+        return true;
+    }
+
+    double fps() const {
+        return rate;
+    }
+
+private:
+    Clock::time_point since{};
+    int frames = 0;
+    double rate = 0.0;
+};
@@ -0,0 +1,175 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "gl.h"
+
+// A finished frame resolved to plain left-to-right rows, width x height pixels
+struct ResolvedFrame {
+    std::vector<Pixel> pixels;
+    int width = 0;
+    int height = 0;
+    float renderMs = 0.0f; // time the frame took to render, without the resolve
+};
+
+// Copies the frame in the color buffer to frame's rows, whatever the buffer layout
+void resolveFrame(const ColorBuffer& buffer, ResolvedFrame& frame) {
+    frame.width = screenWidth;
+    frame.height = screenHeight;
+    frame.pixels.resize(size_t(screenWidth) * screenHeight);
+    for (int y = 0; y < screenHeight; ++y) {
+        resolveRow(buffer, y, &frame.pixels[size_t(y) * screenWidth]);
+    }
+}
+
+// Where finished frames go: the SDL window, or image files when rendering headless.
+// Every call happens on the main thread, which is the only thread SDL lets present.
+class FrameSink {
+public:
+    virtual ~FrameSink() = default;
+
+    virtual bool open() = 0;
+    virtual void close() = 0;
+
+    // Takes the pixels of a resolved frame; the frame can be reused as soon as this returns
+    virtual void upload(const ResolvedFrame& frame) = 0;
+
+    // Shows (or stores) the frame that was last uploaded
+    virtual void flip() = 0;
+};
+
+// Frames that can be in flight at once: 1 renders and presents in turn on the main
+// thread, 2 or 3 render on the render thread ahead of the presentation
+const int MAX_FRAMES_IN_FLIGHT = 3;
+int framesInFlight = 2;
+
+// Renders on its own thread so the next frame is rasterized while the main thread uploads
+// and flips the previous one. The main thread hands every frame over as a job with
+// submit(), takes finished frames back in order with next() and returns each one with
+// release() once the sink has its pixels. The render thread runs a job, resolves the
+// color buffer into a free slot of the ring and marks it ready. With two slots the
+// renderer runs at most one frame ahead of the screen, with three it runs two ahead.
+// Jobs own everything they read, so the main thread can build the next frame meanwhile.
+class RenderThread {
+public:
+    using Job = std::function<void()>;
+
+    ~RenderThread() {
+        stop();
+    }
+
+    void start(int count) {
+        slotCount = count;
+        for (int i = 0; i < slotCount; ++i) {
+            freeSlots.push_back(i);
+        }
+        thread = std::thread([this] { renderLoop(); });
+    }
+
+    // Renders every submitted job, then stops the thread. Finished frames stay in the
+    // ring until they are released.
+    void stop() {
+        if (!thread.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        thread.join();
+    }
+
+    // Waits until every submitted job has rendered, so nothing reads the render targets
+    void drain() {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return jobs.empty() && !rendering; });
+    }
+
+    void submit(Job job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(std::move(job));
+            ++pending;
+        }
+        changed.notify_all();
+    }
+
+    // Frames submitted and not yet released
+    int inFlight() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return pending;
+    }
+
+    // Waits for the oldest frame in flight to finish rendering
+    ResolvedFrame& next() {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return !readySlots.empty(); });
+        return slots[readySlots.front()];
+    }
+
+    // Hands the frame returned by next() back to the render thread
+    void release() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            freeSlots.push_back(readySlots.front());
+            readySlots.pop_front();
+            --pending;
+        }
+        changed.notify_all();
+    }
+
+private:
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<Job> jobs;
+    std::deque<int> freeSlots;
+    std::deque<int> readySlots;
+    std::array<ResolvedFrame, MAX_FRAMES_IN_FLIGHT> slots;
+    int slotCount = 0;
+    int pending = 0;
+    bool rendering = false;
+    bool stopping = false;
+
+    void renderLoop() {
+        while (true) {
+            Job job;
+            int slot;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [this] { return stopping || (!jobs.empty() && !freeSlots.empty()); });
+                if (jobs.empty()) {
+                    return;
+                }
+                if (freeSlots.empty()) {
+                    // Stopping with every slot waiting to be presented: the rest is dropped
+                    jobs.clear();
+                    changed.notify_all();
+                    return;
+                }
+                job = std::move(jobs.front());
+                jobs.pop_front();
+                slot = freeSlots.front();
+                freeSlots.pop_front();
+                rendering = true;
+            }
+
+            auto renderStart = std::chrono::steady_clock::now();
+            job();
+            std::chrono::duration<float, std::milli> renderTime = std::chrono::steady_clock::now() - renderStart;
+            resolveFrame(*framebuffer, slots[slot]);
+            slots[slot].renderMs = renderTime.count();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                readySlots.push_back(slot);
+                rendering = false;
+            }
+            changed.notify_all();
+        }
+    }
+};
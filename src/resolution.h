@@ -0,0 +1,53 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+
+// Dynamic resolution: picks the fraction of the window resolution that is rendered so
+// that the render time of a frame stays under a budget. The smaller frame is stretched
+// back to the window with bilinear filtering when it is presented.
+class ResolutionController {
+public:
+    float targetMs = 1000.0f / 60.0f;
+    float minScale = 0.5f;
+    float maxScale = 1.0f;
+
+    float scale() const {
+        return currentScale;
+    }
+
+    // Feeds the render time of the last frame. Returns true when the scale changed.
+    bool update(float frameMs) {
+        averageMs = averageMs == 0.0f ? frameMs : averageMs + (frameMs - averageMs) * 0.2f;
+
+        if (cooldown > 0) {
+            --cooldown;
+            return false;
+        }
+
+        // Render time grows with the number of pixels, i.e. with the square of the scale.
+        // Scale down as soon as the budget is exceeded, but only scale up with some headroom
+        // left so the controller does not oscillate around the target.
+        float next = currentScale;
+        if (averageMs > targetMs) {
+            next = currentScale * std::max(std::sqrt(targetMs / averageMs), 0.8f);
+        } else if (averageMs < targetMs * 0.7f) {
+            next = currentScale * std::min(std::sqrt(targetMs * 0.85f / averageMs), 1.1f);
+        }
+
+        // Steps of 1/32 keep small fluctuations from reallocating the targets every frame
+        next = std::clamp(std::round(next * 32.0f) / 32.0f, minScale, maxScale);
+        if (next == currentScale) {
+            return false;
+        }
+
+        currentScale = next;
+        averageMs = 0.0f;
+        cooldown = 10;
+        return true;
+    }
+
+private:
+    float currentScale = 1.0f;
+    float averageMs = 0.0f;
+    int cooldown = 0;
+};
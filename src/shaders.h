@@ -15,52 +15,207 @@
 const glm::vec3 white = glm::vec3(1.0f, 1.0f, 1.0f);  // 1, 1, 1: White
 const glm::vec3 black = glm::vec3(0.0f, 0.0f, 0.0f);  // 0, 0, 0: Black
 
-Vertex vertexShader(const Vertex& vertex, const Uniforms& uniforms) {
-    // genera codigo para imprimir toda una matriz de glm::mat4
-
-    // Apply transformations to the input vertex using the matrices from the uniforms
-    glm::vec4 clipSpaceVertex = uniforms.projection * uniforms.view * uniforms.model * glm::vec4(vertex.position, 1.0f);
-
-    // Perspective divide
-    glm::vec3 ndcVertex = glm::vec3(clipSpaceVertex) / clipSpaceVertex.w;
-
-    // Apply the viewport transform
-    glm::vec4 screenVertex = uniforms.viewport * glm::vec4(ndcVertex, 1.0f);
+// The perspective divide and the viewport transform happen in primitiveAssembly(),
+// after clipping, because they are meaningless for vertices behind the camera.
+// This is the reference for the batched vertex kernels (vertices.h): every product is
+// written out component by component so they can repeat the same operations in the same
+// order and produce bit-identical vertices.
+Vertex vertexShader(const Vertex& vertex, const DrawUniforms& uniforms) {
+    const glm::mat4& mvp = uniforms.modelViewProjection;
+    const glm::mat4& model = uniforms.model;
+    const glm::mat3& normalMatrix = uniforms.normal;
+    const glm::vec3& p = vertex.position;
+    const glm::vec3& n = vertex.normal;
+
+    // Apply transformations to the input vertex
+    glm::vec4 clipSpaceVertex(
+            mvp[0][0] * p.x + mvp[1][0] * p.y + mvp[2][0] * p.z + mvp[3][0],
+            mvp[0][1] * p.x + mvp[1][1] * p.y + mvp[2][1] * p.z + mvp[3][1],
+            mvp[0][2] * p.x + mvp[1][2] * p.y + mvp[2][2] * p.z + mvp[3][2],
+            mvp[0][3] * p.x + mvp[1][3] * p.y + mvp[2][3] * p.z + mvp[3][3]
+    );
 
-    // Transform the normal
-    glm::vec3 transformedNormal = glm::mat3(uniforms.model) * vertex.normal;
-    transformedNormal = glm::normalize(transformedNormal);
+    glm::vec3 transformedWorldPosition(
+            model[0][0] * p.x + model[1][0] * p.y + model[2][0] * p.z + model[3][0],
+            model[0][1] * p.x + model[1][1] * p.y + model[2][1] * p.z + model[3][1],
+            model[0][2] * p.x + model[1][2] * p.y + model[2][2] * p.z + model[3][2]
+    );
 
-    glm::vec3 transformedWorldPosition = glm::vec3(uniforms.model * glm::vec4(vertex.position, 1.0f));
+    // Transform and normalize the normal
+    glm::vec3 transformedNormal(
+            normalMatrix[0][0] * n.x + normalMatrix[1][0] * n.y + normalMatrix[2][0] * n.z,
+            normalMatrix[0][1] * n.x + normalMatrix[1][1] * n.y + normalMatrix[2][1] * n.z,
+            normalMatrix[0][2] * n.x + normalMatrix[1][2] * n.y + normalMatrix[2][2] * n.z
+    );
+    float invLength = 1.0f / std::sqrt(transformedNormal.x * transformedNormal.x + transformedNormal.y * transformedNormal.y + transformedNormal.z * transformedNormal.z);
+    transformedNormal = glm::vec3(transformedNormal.x * invLength, transformedNormal.y * invLength, transformedNormal.z * invLength);
 
-    // Return the transformed vertex as a vec3
     return Vertex{
-            glm::vec3(screenVertex),
+            glm::vec3(),
             transformedNormal,
             vertex.tex,
             transformedWorldPosition,
-            vertex.position
+            vertex.position,
+            clipSpaceVertex
     };
 }
 
-std::vector<std::vector<Vertex>> primitiveAssembly (
-    const std::vector<Vertex>& transformedVertices
-) {
-    // Assemble the transformed vertices into triangles
-    // Return a vector of triangles, where each triangle is a vector of 3 vertices (vec3)
+enum class CullMode {
+    None,
+    Back,
+    Front,
+};
+
+// Signed area of the screen-space triangle (doubled), positive for counter-clockwise winding.
+// The viewport transform keeps the orientation of NDC, so counter-clockwise means front-facing.
+float signedArea(const Vertex& a, const Vertex& b, const Vertex& c) {
+    return (b.position.x - a.position.x) * (c.position.y - a.position.y)
+         - (b.position.y - a.position.y) * (c.position.x - a.position.x);
+}
 
-    std::vector<std::vector<Vertex>> groupedVertices;
+// Clip-space x and y may reach guardBand * w before a triangle is actually clipped. Inside the
+// guard band the rasterizer just clamps the bounding box to the viewport, which is much cheaper
+// than clipping; beyond it screen coordinates would get too large for the edge equations.
+const float guardBand = 8.0f;
+
+enum ClipPlane {
+    CLIP_NEAR,
+    CLIP_LEFT,
+    CLIP_RIGHT,
+    CLIP_BOTTOM,
+    CLIP_TOP,
+    CLIP_PLANE_COUNT
+};
+
+// Signed distance of a clip-space position to a plane; inside when >= 0.
+// extent is 1 for the viewport itself and guardBand for the guard band.
+float clipDistance(const glm::vec4& p, int plane, float extent) {
+    switch (plane) {
+        case CLIP_NEAR:
+            return p.z + p.w;
+        case CLIP_LEFT:
+            return extent * p.w + p.x;
+        case CLIP_RIGHT:
+            return extent * p.w - p.x;
+        case CLIP_BOTTOM:
+            return extent * p.w + p.y;
+        default:
+            return extent * p.w - p.y;
+    }
+}
+
+int outcode(const glm::vec4& p, float extent) {
+    int code = 0;
+    for (int plane = 0; plane < CLIP_PLANE_COUNT; ++plane) {
+        if (clipDistance(p, plane, extent) < 0) {
+            code |= 1 << plane;
+        }
+    }
+    return code;
+}
 
-    for (int i = 0; i < transformedVertices.size(); i += 3) {
-        std::vector<Vertex> vertexGroup;
-        vertexGroup.push_back(transformedVertices[i]);
-        vertexGroup.push_back(transformedVertices[i+1]);
-        vertexGroup.push_back(transformedVertices[i+2]);
+Vertex lerpVertex(const Vertex& a, const Vertex& b, float t) {
+    return Vertex{
+            glm::vec3(),
+            glm::mix(a.normal, b.normal, t),
+            glm::mix(a.tex, b.tex, t),
+            glm::mix(a.worldPos, b.worldPos, t),
+            glm::mix(a.originalPos, b.originalPos, t),
+            glm::mix(a.clipPosition, b.clipPosition, t)
+    };
+}
 
-        groupedVertices.push_back(vertexGroup);
+// Perspective divide and viewport transform
+void projectToScreen(Vertex& vertex, const glm::mat4& viewport) {
+    glm::vec3 ndcVertex = glm::vec3(vertex.clipPosition) / vertex.clipPosition.w;
+    vertex.position = glm::vec3(viewport * glm::vec4(ndcVertex, 1.0f));
+}
+
+// Sutherland-Hodgman against the planes in clipMask. A triangle grows by at most one
+// vertex per plane, so 3 + CLIP_PLANE_COUNT vertices always fit.
+const int MAX_CLIPPED_VERTICES = 3 + CLIP_PLANE_COUNT;
+
+int clipPolygon(Vertex (&polygon)[MAX_CLIPPED_VERTICES], int count, int clipMask) {
+    Vertex clipped[MAX_CLIPPED_VERTICES];
+
+    for (int plane = 0; plane < CLIP_PLANE_COUNT && count > 0; ++plane) {
+        if (!(clipMask & (1 << plane)))
+            continue;
+
+        int clippedCount = 0;
+        for (int i = 0; i < count; ++i) {
+            const Vertex& current = polygon[i];
+            const Vertex& next = polygon[(i + 1) % count];
+            float dCurrent = clipDistance(current.clipPosition, plane, guardBand);
+            float dNext = clipDistance(next.clipPosition, plane, guardBand);
+
+            if (dCurrent >= 0) {
+                clipped[clippedCount++] = current;
+            }
+            if ((dCurrent >= 0) != (dNext >= 0)) {
+                clipped[clippedCount++] = lerpVertex(current, next, dCurrent / (dCurrent - dNext));
+            }
+        }
+
+        std::copy(clipped, clipped + clippedCount, polygon);
+        count = clippedCount;
     }
+    return count;
+}
+
+// Assemble the transformed vertices into triangles, three indices per triangle
+// Triangles completely outside the viewport or behind the near plane are rejected, the ones
+// crossing the near plane or the guard band are clipped in homogeneous space and re-triangulated.
+// Every triangle that survives culling is passed to emit(a, b, c) instead of being copied into a new vector.
+// Triangles too small to cover a pixel center are dropped here as well, whatever the cull mode.
+template <typename Emit>
+void primitiveAssembly (
+    const Vertex* transformedVertices,
+    const std::vector<std::uint32_t>& indices,
+    const glm::mat4& viewport,
+    CullMode cullMode,
+    Emit&& emit
+) {
+    auto emitProjected = [&](Vertex a, Vertex b, Vertex c) {
+        projectToScreen(a, viewport);
+        projectToScreen(b, viewport);
+        projectToScreen(c, viewport);
+
+        float area = signedArea(a, b, c);
 
-    return groupedVertices;
+        if (!(std::abs(area) >= minTriangleArea))
+            return;
+        if (cullMode == CullMode::Back && area < 0)
+            return;
+        if (cullMode == CullMode::Front && area > 0)
+            return;
+
+        emit(a, b, c);
+    };
+
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        const Vertex& a = transformedVertices[indices[i]];
+        const Vertex& b = transformedVertices[indices[i+1]];
+        const Vertex& c = transformedVertices[indices[i+2]];
+
+        // Trivial reject: all three vertices outside the same viewport plane
+        if (outcode(a.clipPosition, 1.0f) & outcode(b.clipPosition, 1.0f) & outcode(c.clipPosition, 1.0f))
+            continue;
+
+        int clipMask = outcode(a.clipPosition, guardBand) | outcode(b.clipPosition, guardBand) | outcode(c.clipPosition, guardBand);
+
+        if (clipMask == 0) {
+            emitProjected(a, b, c);
+            continue;
+        }
+
+        Vertex polygon[MAX_CLIPPED_VERTICES] = {a, b, c};
+        int count = clipPolygon(polygon, 3, clipMask);
+
+        for (int k = 1; k + 1 < count; ++k) {
+            emitProjected(polygon[0], polygon[k], polygon[k + 1]);
+        }
+    }
 }
 
 Fragment fragmentShader(Fragment fragment) {
@@ -259,7 +414,7 @@ Fragment fragmentShaderUranusRevised(Fragment& fragment) {
     uv.y = acos(y / sqrt(x*x + y*y + z*z)) / PI;
 
     // Ruido para las nubes
-    static FastNoiseLite noiseGenerator; // Estático para mejor rendimiento
+    static thread_local FastNoiseLite noiseGenerator; // Estático (por hilo) para mejor rendimiento
     noiseGenerator.SetNoiseType(FastNoiseLite::NoiseType_OpenSimplex2);
 
     // Escala del ruido para una transición más suave
@@ -338,8 +493,9 @@ Fragment noiseFragmentShader(Fragment& fragment) {
     FastNoiseLite noiseGenerator;
     noiseGenerator.SetNoiseType(FastNoiseLite::NoiseType_OpenSimplex2);
 
-    float ox = 5500.0f;
-    float oy = 6900.0f;
+    // Every instance samples its own part of the noise
+    float ox = 5500.0f + fragment.seed;
+    float oy = 6900.0f + fragment.seed;
     float z = 150.0f;
 
     float noiseValue = noiseGenerator.GetNoise((uv.x + ox) * z, (uv.y + oy) * z);
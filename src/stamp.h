@@ -0,0 +1,320 @@
+// stamp.h
+#pragma once
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include "color.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+#define STAMP_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// GCC/Clang need the instruction set enabled per function so a single build can carry
+// every kernel; MSVC always accepts the intrinsics.
+#if defined(_MSC_VER)
+#define STAMP_TARGET(isa)
+#else
+#define STAMP_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+// A stamp is a horizontal run of up to 8 pixels that the rasterizer evaluates at once
+const int STAMP_WIDTH = 8;
+const float coverageEpsilon = 1e-10f;
+
+// Interpolated channels: depth, normal, world position, object space position.
+// Screen-space depth is affine in screen space and interpolated as is; every other channel
+// is stored divided by w and corrected per pixel with the interpolated 1/w.
+enum StampChannel {
+    CHANNEL_Z,
+    CHANNEL_NORMAL_X, CHANNEL_NORMAL_Y, CHANNEL_NORMAL_Z,
+    CHANNEL_WORLD_X, CHANNEL_WORLD_Y, CHANNEL_WORLD_Z,
+    CHANNEL_ORIGINAL_X, CHANNEL_ORIGINAL_Y, CHANNEL_ORIGINAL_Z,
+    CHANNEL_COUNT
+};
+
+const int FIRST_PERSPECTIVE_CHANNEL = CHANNEL_NORMAL_X;
+
+// Triangle setup as seen by the kernels. Edges give the screen-space barycentric weights
+// (w, v, u) of a pixel offset (dx, dy) from vertex A. Every channel, and 1/w, is a plane
+// base + dv * v + du * u; perspective channels are then multiplied by w = 1 / (1/w).
+struct StampSetup {
+    float edgeA[3];
+    float edgeB[3];
+    float edgeC[3];
+    float base[CHANNEL_COUNT];
+    float dv[CHANNEL_COUNT];
+    float du[CHANNEL_COUNT];
+    float invWBase;
+    float invWdv;
+    float invWdu;
+};
+
+struct alignas(32) PixelStamp {
+    float channels[CHANNEL_COUNT][STAMP_WIDTH];
+    float v[STAMP_WIDTH]; // barycentric weights of B and C
+    float u[STAMP_WIDTH];
+    int mask; // bit i set when pixel i is covered
+};
+
+// Only the first channelCount channels are interpolated (1 = depth only)
+typedef void (*StampKernel)(const StampSetup& setup, float dx, float dy, int count, int channelCount, PixelStamp& out);
+
+// Packs the shaded colors of a stamp, STAMP_WIDTH of them, into pixels
+typedef void (*PackKernel)(const Color* colors, Pixel* out);
+
+// Reference implementation. The vector kernels perform the same operations in the same
+// order, so all of them produce bit-identical stamps.
+void stampScalar(const StampSetup& setup, float dx, float dy, int count, int channelCount, PixelStamp& out) {
+    float* v = out.v;
+    float* u = out.u;
+    out.mask = 0;
+
+    for (int i = 0; i < count; ++i) {
+        float px = dx + float(i);
+        float w = setup.edgeA[0] * px + setup.edgeB[0] * dy + setup.edgeC[0];
+        v[i] = setup.edgeA[1] * px + setup.edgeB[1] * dy + setup.edgeC[1];
+        u[i] = setup.edgeA[2] * px + setup.edgeB[2] * dy + setup.edgeC[2];
+
+        if (w >= coverageEpsilon && v[i] >= coverageEpsilon && u[i] >= coverageEpsilon) {
+            out.mask |= 1 << i;
+        }
+    }
+
+    if (out.mask == 0) {
+        return;
+    }
+
+    for (int c = 0; c < std::min(channelCount, FIRST_PERSPECTIVE_CHANNEL); ++c) {
+        for (int i = 0; i < count; ++i) {
+            out.channels[c][i] = setup.base[c] + setup.dv[c] * v[i] + setup.du[c] * u[i];
+        }
+    }
+
+    if (channelCount <= FIRST_PERSPECTIVE_CHANNEL) {
+        return;
+    }
+
+    float clipW[STAMP_WIDTH];
+    for (int i = 0; i < count; ++i) {
+        clipW[i] = 1.0f / (setup.invWBase + setup.invWdv * v[i] + setup.invWdu * u[i]);
+    }
+
+    for (int c = FIRST_PERSPECTIVE_CHANNEL; c < channelCount; ++c) {
+        for (int i = 0; i < count; ++i) {
+            out.channels[c][i] = (setup.base[c] + setup.dv[c] * v[i] + setup.du[c] * u[i]) * clipW[i];
+        }
+    }
+}
+
+// Reference implementation: packColor() one pixel at a time
+void packStampScalar(const Color* colors, Pixel* out) {
+    for (int i = 0; i < STAMP_WIDTH; ++i) {
+        out[i] = packColor(colors[i]);
+    }
+}
+
+#ifdef STAMP_X86
+
+// One Color is one register, so four pixels are rounded together and narrowed to bytes
+// with saturating packs, which leaves them in R, G, B, A memory order. The clamp and the
+// truncating conversion are those of packColor(), so the pixels are bit-identical (NaN
+// becomes 0 because _mm_max_ps returns its second operand).
+STAMP_TARGET("sse4.1")
+void packStampSSE41(const Color* colors, Pixel* out) {
+    const __m128 scale = _mm_set1_ps(255.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 full = _mm_set1_ps(255.0f);
+
+    __m128i channels[STAMP_WIDTH];
+    for (int i = 0; i < STAMP_WIDTH; ++i) {
+        __m128 value = _mm_add_ps(_mm_mul_ps(_mm_load_ps(&colors[i].r), scale), half);
+        channels[i] = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(value, zero), full));
+    }
+
+    for (int i = 0; i < STAMP_WIDTH; i += 4) {
+        __m128i low = _mm_packus_epi32(channels[i], channels[i + 1]);
+        __m128i high = _mm_packus_epi32(channels[i + 2], channels[i + 3]);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(low, high));
+    }
+}
+
+STAMP_TARGET("sse4.1")
+void stampSSE41(const StampSetup& setup, float dx, float dy, int count, int channelCount, PixelStamp& out) {
+    const __m128 eps = _mm_set1_ps(coverageEpsilon);
+    const __m128 py = _mm_set1_ps(dy);
+    __m128 v[2];
+    __m128 u[2];
+    int mask = 0;
+
+    for (int half = 0; half < 2; ++half) {
+        __m128 px = _mm_add_ps(_mm_set1_ps(dx), _mm_setr_ps(half * 4 + 0.0f, half * 4 + 1.0f, half * 4 + 2.0f, half * 4 + 3.0f));
+        __m128 w = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(setup.edgeA[0]), px), _mm_mul_ps(_mm_set1_ps(setup.edgeB[0]), py)), _mm_set1_ps(setup.edgeC[0]));
+        v[half] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(setup.edgeA[1]), px), _mm_mul_ps(_mm_set1_ps(setup.edgeB[1]), py)), _mm_set1_ps(setup.edgeC[1]));
+        u[half] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(setup.edgeA[2]), px), _mm_mul_ps(_mm_set1_ps(setup.edgeB[2]), py)), _mm_set1_ps(setup.edgeC[2]));
+
+        __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(w, eps), _mm_cmpge_ps(v[half], eps)), _mm_cmpge_ps(u[half], eps));
+        mask |= _mm_movemask_ps(inside) << (half * 4);
+    }
+
+    out.mask = mask & ((1 << count) - 1);
+    if (out.mask == 0) {
+        return;
+    }
+
+    for (int half = 0; half < 2; ++half) {
+        _mm_store_ps(&out.v[half * 4], v[half]);
+        _mm_store_ps(&out.u[half * 4], u[half]);
+    }
+
+    __m128 clipW[2] = {_mm_setzero_ps(), _mm_setzero_ps()};
+    if (channelCount > FIRST_PERSPECTIVE_CHANNEL) {
+        for (int half = 0; half < 2; ++half) {
+            __m128 invW = _mm_add_ps(_mm_add_ps(_mm_set1_ps(setup.invWBase), _mm_mul_ps(_mm_set1_ps(setup.invWdv), v[half])), _mm_mul_ps(_mm_set1_ps(setup.invWdu), u[half]));
+            clipW[half] = _mm_div_ps(_mm_set1_ps(1.0f), invW);
+        }
+    }
+
+    for (int c = 0; c < channelCount; ++c) {
+        __m128 base = _mm_set1_ps(setup.base[c]);
+        __m128 dv = _mm_set1_ps(setup.dv[c]);
+        __m128 du = _mm_set1_ps(setup.du[c]);
+        for (int half = 0; half < 2; ++half) {
+            __m128 value = _mm_add_ps(_mm_add_ps(base, _mm_mul_ps(dv, v[half])), _mm_mul_ps(du, u[half]));
+            if (c >= FIRST_PERSPECTIVE_CHANNEL) {
+                value = _mm_mul_ps(value, clipW[half]);
+            }
+            _mm_store_ps(&out.channels[c][half * 4], value);
+        }
+    }
+}
+
+STAMP_TARGET("avx2")
+void stampAVX2(const StampSetup& setup, float dx, float dy, int count, int channelCount, PixelStamp& out) {
+    const __m256 eps = _mm256_set1_ps(coverageEpsilon);
+    const __m256 px = _mm256_add_ps(_mm256_set1_ps(dx), _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f));
+    const __m256 py = _mm256_set1_ps(dy);
+
+    __m256 w = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(setup.edgeA[0]), px), _mm256_mul_ps(_mm256_set1_ps(setup.edgeB[0]), py)), _mm256_set1_ps(setup.edgeC[0]));
+    __m256 v = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(setup.edgeA[1]), px), _mm256_mul_ps(_mm256_set1_ps(setup.edgeB[1]), py)), _mm256_set1_ps(setup.edgeC[1]));
+    __m256 u = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(setup.edgeA[2]), px), _mm256_mul_ps(_mm256_set1_ps(setup.edgeB[2]), py)), _mm256_set1_ps(setup.edgeC[2]));
+
+    __m256 inside = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(w, eps, _CMP_GE_OQ), _mm256_cmp_ps(v, eps, _CMP_GE_OQ)), _mm256_cmp_ps(u, eps, _CMP_GE_OQ));
+    out.mask = _mm256_movemask_ps(inside) & ((1 << count) - 1);
+    if (out.mask == 0) {
+        return;
+    }
+
+    _mm256_store_ps(out.v, v);
+    _mm256_store_ps(out.u, u);
+
+    __m256 clipW = _mm256_setzero_ps();
+    if (channelCount > FIRST_PERSPECTIVE_CHANNEL) {
+        __m256 invW = _mm256_add_ps(
+                _mm256_add_ps(_mm256_set1_ps(setup.invWBase), _mm256_mul_ps(_mm256_set1_ps(setup.invWdv), v)),
+                _mm256_mul_ps(_mm256_set1_ps(setup.invWdu), u)
+        );
+        clipW = _mm256_div_ps(_mm256_set1_ps(1.0f), invW);
+    }
+
+    for (int c = 0; c < channelCount; ++c) {
+        __m256 value = _mm256_add_ps(
+                _mm256_add_ps(_mm256_set1_ps(setup.base[c]), _mm256_mul_ps(_mm256_set1_ps(setup.dv[c]), v)),
+                _mm256_mul_ps(_mm256_set1_ps(setup.du[c]), u)
+        );
+        if (c >= FIRST_PERSPECTIVE_CHANNEL) {
+            value = _mm256_mul_ps(value, clipW);
+        }
+        _mm256_store_ps(out.channels[c], value);
+    }
+}
+
+#endif
+
+enum class SimdLevel {
+    Scalar,
+    SSE41,
+    AVX2,
+};
+
+const char* simdLevelName(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::AVX2:
+            return "avx2";
+        case SimdLevel::SSE41:
+            return "sse4.1";
+        default:
+            return "scalar";
+    }
+}
+
+// Highest instruction set supported by the CPU (and the OS, for the AVX registers)
+SimdLevel detectSimdLevel() {
+#if defined(STAMP_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    bool sse41 = (info[2] & (1 << 19)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    __cpuidex(info, 7, 0);
+    bool avx2 = (info[1] & (1 << 5)) != 0;
+    if (avx2 && avx && osxsave && (_xgetbv(0) & 0x6) == 0x6) {
+        return SimdLevel::AVX2;
+    }
+    if (sse41) {
+        return SimdLevel::SSE41;
+    }
+#elif defined(STAMP_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return SimdLevel::AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return SimdLevel::SSE41;
+    }
+#endif
+    return SimdLevel::Scalar;
+}
+
+bool parseSimdLevel(const std::string& name, SimdLevel& level) {
+    for (SimdLevel candidate : {SimdLevel::Scalar, SimdLevel::SSE41, SimdLevel::AVX2}) {
+        if (name == simdLevelName(candidate)) {
+            level = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+StampKernel selectStampKernel(SimdLevel level) {
+#ifdef STAMP_X86
+    switch (level) {
+        case SimdLevel::AVX2:
+            return stampAVX2;
+        case SimdLevel::SSE41:
+            return stampSSE41;
+        default:
+            break;
+    }
+#endif
+    return stampScalar;
+}
+
+// AVX2 has no byte packs across its two halves, so it keeps the SSE4.1 kernel
+PackKernel selectPackKernel(SimdLevel level) {
+#ifdef STAMP_X86
+    if (level >= SimdLevel::SSE41) {
+        return packStampSSE41;
+    }
+#endif
+    return packStampScalar;
+}
+
+// Chosen once at startup; main() may lower it (--simd) but never raise it above the CPU
+SimdLevel simdLevel = detectSimdLevel();
+StampKernel stampKernel = selectStampKernel(simdLevel);
+PackKernel packKernel = selectPackKernel(simdLevel);
@@ -0,0 +1,237 @@
+// tiles.h
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "gl.h"
+
+// Screen is split in fixed-size tiles. Each tile is rasterized by exactly one worker,
+// so the color buffer and the zbuffer inside a tile never need a lock.
+const int TILE_SIZE = 64;
+
+// The tile grid follows the current render target size
+int tilesX() {
+    return (screenWidth + TILE_SIZE - 1) / TILE_SIZE;
+}
+
+int tilesY() {
+    return (screenHeight + TILE_SIZE - 1) / TILE_SIZE;
+}
+
+int tileCount() {
+    return tilesX() * tilesY();
+}
+
+static_assert(TILE_SIZE % DEPTH_TILE_SIZE == 0, "depth tiles must not straddle tiles");
+
+// Inclusive pixel bounds
+struct TileRect {
+    int minX;
+    int minY;
+    int maxX;
+    int maxY;
+};
+
+const TileRect emptyRect = {0, 0, -1, -1};
+
+bool isEmpty(const TileRect& rect) {
+    return rect.minX > rect.maxX || rect.minY > rect.maxY;
+}
+
+TileRect unite(const TileRect& a, const TileRect& b) {
+    if (isEmpty(a))
+        return b;
+    if (isEmpty(b))
+        return a;
+    return TileRect{std::min(a.minX, b.minX), std::min(a.minY, b.minY), std::max(a.maxX, b.maxX), std::max(a.maxY, b.maxY)};
+}
+
+TileRect tileRect(int tile) {
+    int tx = tile % tilesX();
+    int ty = tile / tilesX();
+    return TileRect{
+            tx * TILE_SIZE,
+            ty * TILE_SIZE,
+            std::min((tx + 1) * TILE_SIZE, screenWidth) - 1,
+            std::min((ty + 1) * TILE_SIZE, screenHeight) - 1
+    };
+}
+
+// Resets the depth of a tile if it has not been cleared this frame yet
+void prepareDepth(const TileRect& rect) {
+    for (int ty = rect.minY / DEPTH_TILE_SIZE; ty <= rect.maxY / DEPTH_TILE_SIZE; ++ty) {
+        for (int tx = rect.minX / DEPTH_TILE_SIZE; tx <= rect.maxX / DEPTH_TILE_SIZE; ++tx) {
+            prepareDepthTile(tx, ty);
+        }
+    }
+}
+
+// Triangle after primitive assembly, tagged with the draw (model) it belongs to and, for
+// instanced draws, the instance (-1 otherwise)
+struct BinnedTriangle {
+    int draw;
+    int instance;
+    Vertex a;
+    Vertex b;
+    Vertex c;
+};
+
+// Pixels under the bounding box of a screen-space triangle, clamped to the screen. False when
+// the triangle is fully off-screen (or NaN), so it is never binned.
+bool pixelBounds(const Vertex& a, const Vertex& b, const Vertex& c, TileRect& pixels) {
+    float minX = std::min(std::min(a.position.x, b.position.x), c.position.x);
+    float minY = std::min(std::min(a.position.y, b.position.y), c.position.y);
+    float maxX = std::max(std::max(a.position.x, b.position.x), c.position.x);
+    float maxY = std::max(std::max(a.position.y, b.position.y), c.position.y);
+
+    if (!(maxX >= 0 && maxY >= 0 && minX <= screenWidth - 1 && minY <= screenHeight - 1)) {
+        return false;
+    }
+
+    pixels = TileRect{
+            static_cast<int>(std::ceil(std::max(minX, 0.0f))),
+            static_cast<int>(std::ceil(std::max(minY, 0.0f))),
+            static_cast<int>(std::min(maxX, float(screenWidth - 1))),
+            static_cast<int>(std::min(maxY, float(screenHeight - 1)))
+    };
+    return true;
+}
+
+// Per-frame triangle list and, for every tile, the indices of the triangles touching it.
+// Indices are appended in submission order so every tile draws in the same order as before.
+struct TileBins {
+    std::vector<BinnedTriangle> triangles;
+    std::vector<std::vector<int>> bins;
+    std::vector<TileRect> drawBounds; // pixels covered by the binned triangles of every draw
+    int columns = 0;
+
+    // Also follows the tile grid when the render targets were resized
+    void reset() {
+        triangles.clear();
+        drawBounds.clear();
+        for (auto& bin : bins) {
+            bin.clear();
+        }
+        bins.resize(tileCount());
+        columns = tilesX();
+    }
+
+    void add(int draw, int instance, const Vertex& a, const Vertex& b, const Vertex& c) {
+        TileRect pixels;
+        if (pixelBounds(a, b, c, pixels)) {
+            insert(BinnedTriangle{draw, instance, a, b, c}, pixels);
+        }
+    }
+
+    // Bins a triangle whose pixelBounds() were already computed (on a worker)
+    void insert(const BinnedTriangle& triangle, const TileRect& pixels) {
+        if (triangle.draw >= static_cast<int>(drawBounds.size())) {
+            drawBounds.resize(triangle.draw + 1, emptyRect);
+        }
+        drawBounds[triangle.draw] = unite(drawBounds[triangle.draw], pixels);
+
+        int firstTileX = pixels.minX / TILE_SIZE;
+        int firstTileY = pixels.minY / TILE_SIZE;
+        int lastTileX = pixels.maxX / TILE_SIZE;
+        int lastTileY = pixels.maxY / TILE_SIZE;
+
+        int index = static_cast<int>(triangles.size());
+        triangles.push_back(triangle);
+
+        for (int ty = firstTileY; ty <= lastTileY; ++ty) {
+            for (int tx = firstTileX; tx <= lastTileX; ++tx) {
+                bins[ty * columns + tx].push_back(index);
+            }
+        }
+    }
+};
+
+// Fixed pool of worker threads. run() hands out tiles through an atomic counter until
+// every tile has been processed; the calling thread works too and returns when all are done.
+class TileWorkers {
+public:
+    explicit TileWorkers(unsigned count) {
+        for (unsigned i = 0; i < count; ++i) {
+            threads.emplace_back([this] { workerLoop(); });
+        }
+    }
+
+    ~TileWorkers() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    void run(int tileCount, const std::function<void(int)>& job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            currentJob = &job;
+            jobTiles = tileCount;
+            nextTile = 0;
+            busyWorkers = static_cast<int>(threads.size());
+            ++generation;
+        }
+        wake.notify_all();
+
+        processTiles();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [this] { return busyWorkers == 0; });
+        currentJob = nullptr;
+    }
+
+private:
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    const std::function<void(int)>* currentJob = nullptr;
+    int jobTiles = 0;
+    std::atomic<int> nextTile{0};
+    int busyWorkers = 0;
+    unsigned long generation = 0;
+    bool stopping = false;
+
+    void processTiles() {
+        for (int tile = nextTile++; tile < jobTiles; tile = nextTile++) {
+            (*currentJob)(tile);
+        }
+    }
+
+    void workerLoop() {
+        unsigned long seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping) {
+                    return;
+                }
+                seen = generation;
+            }
+
+            processTiles();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                --busyWorkers;
+            }
+            finished.notify_one();
+        }
+    }
+};
+
+// The calling thread also rasterizes, so spawn one worker less than the hardware threads
+TileWorkers& tileWorkers() {
+    static TileWorkers workers(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    return workers;
+}
@@ -1,82 +1,306 @@
 #pragma once
+#include <bit>
+#include <cstdint>
 #include "gl.h"
+#include "tiles.h"
+#include "stamp.h"
 
 glm::vec3 L = glm::vec3(0.0f, 0.0f, 1.0f);
 
-std::pair<float, float> barycentricCoordinates(const glm::ivec2& P, const glm::vec3& A, const glm::vec3& B, const glm::vec3& C) {
-    glm::vec3 bary = glm::cross(
-            glm::vec3(C.x - A.x, B.x - A.x, A.x - P.x),
-            glm::vec3(C.y - A.y, B.y - A.y, A.y - P.y)
-    );
+static_assert(STAMP_WIDTH == DEPTH_BLOCK_SIZE, "a stamp is one row of a depth block");
 
-    if (abs(bary.z) < 1) {
-        return std::make_pair(-1, -1);
+// Edge equation E(x, y) = a*x + b*y + c. Coefficients are pre-scaled by 1/area,
+// so evaluating the three edges of a triangle yields its barycentric weights.
+struct EdgeFunction {
+    float a;
+    float b;
+    float c;
+};
+
+// Per-triangle setup: computed once and then evaluated stamp by stamp across the bounding box.
+// Edges are expressed relative to vertex A to keep the constant terms small.
+struct TriangleSetup {
+    float originX;
+    float originY;
+    EdgeFunction w; // weight of A
+    EdgeFunction v; // weight of B
+    EdgeFunction u; // weight of C
+};
+
+// Barycentric coordinates of P with respect to ABC, rewritten as linear functions of P.
+// Triangles with less than one pixel of (doubled) area are rejected.
+bool setupTriangle(const glm::vec3& A, const glm::vec3& B, const glm::vec3& C, TriangleSetup& setup) {
+    float area = (C.x - A.x) * (B.y - A.y) - (B.x - A.x) * (C.y - A.y);
+
+    if (std::abs(area) < minTriangleArea) {
+        return false;
+    }
+
+    float invArea = 1.0f / area;
+
+    setup.originX = A.x;
+    setup.originY = A.y;
+    setup.v = EdgeFunction{-(C.y - A.y) * invArea, (C.x - A.x) * invArea, 0.0f};
+    setup.u = EdgeFunction{(B.y - A.y) * invArea, -(B.x - A.x) * invArea, 0.0f};
+    setup.w = EdgeFunction{-setup.v.a - setup.u.a, -setup.v.b - setup.u.b, 1.0f};
+
+    return true;
+}
+
+void setChannel(StampSetup& stamp, int channel, float a, float b, float c) {
+    stamp.base[channel] = a;
+    stamp.dv[channel] = b - a;
+    stamp.du[channel] = c - a;
+}
+
+// Perspective channels are stored divided by w (multiplied by 1/w) so that they become
+// affine in screen space; the kernels multiply them back by the interpolated w
+void setupChannels(StampSetup& stamp, const Vertex& a, const Vertex& b, const Vertex& c) {
+    float qa = 1.0f / a.clipPosition.w;
+    float qb = 1.0f / b.clipPosition.w;
+    float qc = 1.0f / c.clipPosition.w;
+    stamp.invWBase = qa;
+    stamp.invWdv = qb - qa;
+    stamp.invWdu = qc - qa;
+
+    setChannel(stamp, CHANNEL_Z, a.position.z, b.position.z, c.position.z);
+    for (int i = 0; i < 3; ++i) {
+        setChannel(stamp, CHANNEL_NORMAL_X + i, a.normal[i] * qa, b.normal[i] * qb, c.normal[i] * qc);
+        setChannel(stamp, CHANNEL_WORLD_X + i, a.worldPos[i] * qa, b.worldPos[i] * qb, c.worldPos[i] * qc);
+        setChannel(stamp, CHANNEL_ORIGINAL_X + i, a.originalPos[i] * qa, b.originalPos[i] * qb, c.originalPos[i] * qc);
+    }
+}
+
+// Packs the edge equations and the vertex attributes for the stamp kernels
+StampSetup setupStamp(const TriangleSetup& setup, const Vertex& a, const Vertex& b, const Vertex& c) {
+    StampSetup stamp;
+    const EdgeFunction* edges[3] = {&setup.w, &setup.v, &setup.u};
+    for (int i = 0; i < 3; ++i) {
+        stamp.edgeA[i] = edges[i]->a;
+        stamp.edgeB[i] = edges[i]->b;
+        stamp.edgeC[i] = edges[i]->c;
     }
 
-    return std::make_pair(
-            bary.y / bary.z,
-            bary.x / bary.z
-    );
+    setupChannels(stamp, a, b, c);
+    return stamp;
 }
 
-std::vector<Fragment> triangle(const Vertex& a, const Vertex& b, const Vertex& c) {
-    std::vector<Fragment> fragments;
+// Builds the fragment handed to the shaders from the interpolated channels of one pixel
+Fragment buildFragment(int x, int y, const float (&channels)[CHANNEL_COUNT]) {
+    glm::vec3 normal(channels[CHANNEL_NORMAL_X], channels[CHANNEL_NORMAL_Y], channels[CHANNEL_NORMAL_Z]);
+
+    // Lambert term of the normalized normal, without normalizing the vector itself
+    float intensity = glm::dot(normal, L) / std::sqrt(glm::dot(normal, normal));
+
+    float manualIntensityClamp = 0.07f;
+
+    if (intensity < manualIntensityClamp){
+        intensity = manualIntensityClamp;
+    }
+
+    Color color = Color(255, 255, 255);
+
+    glm::vec3 worldPos(channels[CHANNEL_WORLD_X], channels[CHANNEL_WORLD_Y], channels[CHANNEL_WORLD_Z]);
+    glm::vec3 originalPos(channels[CHANNEL_ORIGINAL_X], channels[CHANNEL_ORIGINAL_Y], channels[CHANNEL_ORIGINAL_Z]);
+
+    return Fragment{
+            glm::vec3(x, y, channels[CHANNEL_Z]),
+            color,
+            intensity,
+            worldPos,
+            originalPos
+    };
+}
+
+// Same interpolation as the stamp kernels, for a single pixel with known barycentrics
+Fragment interpolateFragment(const StampSetup& stamp, int x, int y, float v, float u) {
+    float channels[CHANNEL_COUNT];
+    float clipW = 1.0f / (stamp.invWBase + stamp.invWdv * v + stamp.invWdu * u);
+    for (int c = 0; c < CHANNEL_COUNT; ++c) {
+        channels[c] = stamp.base[c] + stamp.dv[c] * v + stamp.du[c] * u;
+        if (c >= FIRST_PERSPECTIVE_CHANNEL) {
+            channels[c] *= clipW;
+        }
+    }
+    return buildFragment(x, y, channels);
+}
+
+// How triangle() uses the zbuffer before a pixel reaches the visitor
+enum class DepthMode {
+    Less,      // early-Z: test and write depth, occluded pixels are never shaded
+    DepthOnly, // depth pre-pass: test and write depth, the visitor is never called
+    Equal,     // after a pre-pass: only the surface that won the depth test is shaded
+};
+
+// Rasterizes the part of the triangle that falls inside tile (inclusive pixel bounds).
+// Every covered pixel that passes the depth test is handed to visit(stamp, lane, x, y)
+// with the first channelCount channels interpolated.
+template <typename LaneVisitor>
+void rasterizeStamps(const Vertex& a, const Vertex& b, const Vertex& c, const TileRect& tile, DepthMode depthMode, int channelCount, LaneVisitor&& visit) {
     glm::vec3 A = a.position;
     glm::vec3 B = b.position;
     glm::vec3 C = c.position;
 
+    TriangleSetup setup;
+    if (!setupTriangle(A, B, C, setup)) {
+        return;
+    }
+
     float minX = std::min(std::min(A.x, B.x), C.x);
     float minY = std::min(std::min(A.y, B.y), C.y);
     float maxX = std::max(std::max(A.x, B.x), C.x);
     float maxY = std::max(std::max(A.y, B.y), C.y);
 
-    // Iterate over each point in the bounding box
-    for (int y = static_cast<int>(std::ceil(minY)); y <= static_cast<int>(std::floor(maxY)); ++y) {
-        for (int x = static_cast<int>(std::ceil(minX)); x <= static_cast<int>(std::floor(maxX)); ++x) {
-            if (x < 0 || y < 0 || y > SCREEN_HEIGHT || x > SCREEN_WIDTH)
-                continue;
+    // Clip the bounding box to the tile before converting to pixels
+    int startX = static_cast<int>(std::ceil(std::max(minX, float(tile.minX))));
+    int startY = static_cast<int>(std::ceil(std::max(minY, float(tile.minY))));
+    int endX = static_cast<int>(std::floor(std::min(maxX, float(tile.maxX))));
+    int endY = static_cast<int>(std::floor(std::min(maxY, float(tile.maxY))));
+
+    if (startX > endX || startY > endY) {
+        return;
+    }
+
+    // Hierarchical depth test against the 8x8 depth blocks under the bounding box. A block
+    // is skipped when the triangle's nearest depth is behind the farthest depth that can be
+    // stored in it (or, for the Equal pass, when the depth ranges do not overlap). Only the
+    // block bounds are read, never the zbuffer. The small margin covers rounding in the
+    // interpolated depth.
+    float nearestZ = std::min(std::min(A.z, B.z), C.z);
+    float farthestZ = std::max(std::max(A.z, B.z), C.z);
+    nearestZ -= std::abs(nearestZ) * 1e-6f;
+    farthestZ += std::abs(farthestZ) * 1e-6f;
+
+    int firstBlockX = startX / DEPTH_BLOCK_SIZE;
+    int firstBlockY = startY / DEPTH_BLOCK_SIZE;
+    int blocksX = endX / DEPTH_BLOCK_SIZE - firstBlockX + 1;
+    int blocksY = endY / DEPTH_BLOCK_SIZE - firstBlockY + 1;
+    std::uint64_t hiddenBlocks = 0; // bit (by * 8 + bx), only tracked for up to 8x8 blocks
+
+    if (blocksX <= 8 && blocksY <= 8) {
+        bool anyVisible = false;
+        for (int by = 0; by < blocksY; ++by) {
+            for (int bx = 0; bx < blocksX; ++bx) {
+                const DepthBlock& block = depthBlock(firstBlockX + bx, firstBlockY + by);
+                bool hidden = depthMode == DepthMode::Equal
+                        ? nearestZ > block.maxZ || farthestZ < block.minZ
+                        : nearestZ >= block.maxZ;
+
+                if (hidden) {
+                    hiddenBlocks |= std::uint64_t(1) << (by * 8 + bx);
+                } else {
+                    anyVisible = true;
+                }
+            }
+        }
+
+        if (!anyVisible) {
+            return;
+        }
+    }
 
-            glm::ivec2 P(x, y);
-            auto barycentric = barycentricCoordinates(P, A, B, C);
-            float w = 1 - barycentric.first - barycentric.second;
-            float v = barycentric.first;
-            float u = barycentric.second;
-            float epsilon = 1e-10;
+    StampSetup stamp = setupStamp(setup, a, b, c);
+    PixelStamp pixels;
 
-            if (w < epsilon || v < epsilon || u < epsilon)
+    // Walk each row in stamps of 8 pixels; the kernel evaluates coverage and interpolates
+    // every channel for the whole stamp at once. Stamps are aligned to the depth blocks,
+    // lanes left of the bounding box are masked off.
+    int alignedStartX = startX - startX % STAMP_WIDTH;
+
+    for (int y = startY; y <= endY; ++y) {
+        float dy = y - setup.originY;
+        int blockRow = (y / DEPTH_BLOCK_SIZE - firstBlockY) * 8;
+
+        for (int x = alignedStartX; x <= endX; x += STAMP_WIDTH) {
+            if (hiddenBlocks & (std::uint64_t(1) << (blockRow + x / DEPTH_BLOCK_SIZE - firstBlockX)))
                 continue;
 
-            double z = A.z * w + B.z * v + C.z * u;
+            int count = std::min(STAMP_WIDTH, endX - x + 1);
+            stampKernel(stamp, x - setup.originX, dy, count, channelCount, pixels);
 
-            glm::vec3 normal = glm::normalize(
-                    a.normal * w + b.normal * v + c.normal * u
-            );
+            // The stamp is one row of a depth block; its writes update the block once
+            int written = 0;
+            float writtenNearest = clearDepth;
+            float writtenFarthest = -clearDepth;
 
-            // glm::vec3 normal = a.normal; // assume flatness
-            float intensity = glm::dot(normal, L);
+            int skipped = std::max(0, startX - x);
+            for (int mask = pixels.mask & ~((1 << skipped) - 1); mask != 0; mask &= mask - 1) {
+                int i = std::countr_zero(static_cast<unsigned>(mask));
+                float z = pixels.channels[CHANNEL_Z][i];
+                float& depth = depthAt(x + i, y);
 
-            float manualIntensityClamp = 0.07f;
+                if (depthMode == DepthMode::Equal) {
+                    if (z != depth)
+                        continue;
+                } else {
+                    if (!(z < depth))
+                        continue;
+                    depth = z;
+                    written |= 1 << i;
+                    writtenNearest = std::min(writtenNearest, z);
+                    writtenFarthest = std::max(writtenFarthest, z);
+                    if (depthMode == DepthMode::DepthOnly)
+                        continue;
+                }
 
-            if (intensity < manualIntensityClamp){
-                intensity = manualIntensityClamp;
+                visit(pixels, i, x + i, y);
+            }
 
+            if (written != 0) {
+                markDepthWritten(x, y, written, writtenNearest, writtenFarthest);
             }
+        }
+    }
+}
+
+// Rasterizes the part of the triangle that falls inside tile (inclusive pixel bounds).
+// Every covered pixel that passes the depth test is handed to visit(Fragment&) as soon
+// as it is produced, so fragments go straight to shading and the framebuffer.
+template <typename Visitor>
+void triangle(const Vertex& a, const Vertex& b, const Vertex& c, const TileRect& tile, DepthMode depthMode, Visitor&& visit) {
+    int channelCount = depthMode == DepthMode::DepthOnly ? 1 : CHANNEL_COUNT;
 
-            Color color = Color(255, 255, 255);
+    rasterizeStamps(a, b, c, tile, depthMode, channelCount, [&](const PixelStamp& pixels, int lane, int x, int y) {
+        float channels[CHANNEL_COUNT];
+        for (int channel = 0; channel < CHANNEL_COUNT; ++channel) {
+            channels[channel] = pixels.channels[channel][lane];
+        }
+
+        Fragment fragment = buildFragment(x, y, channels);
+        visit(fragment);
+    });
+}
+
+// Collects the shaded colors of one stamp and packs them together once the pixels move on
+// to another stamp. The rasterizer produces fragments stamp by stamp, so most stamps are
+// packed with a single packKernel call. flush() before the color buffer is used.
+struct StampWriter {
+    Color colors[STAMP_WIDTH];
+    int mask = 0;
+    int stampX = 0;
+    int stampY = 0;
+
+    void write(const Fragment& fragment) {
+        int x = static_cast<int>(fragment.position.x);
+        int y = static_cast<int>(fragment.position.y);
+        if (mask != 0 && (y != stampY || x - x % STAMP_WIDTH != stampX)) {
+            flush();
+        }
+        stampX = x - x % STAMP_WIDTH;
+        stampY = y;
+        colors[x - stampX] = fragment.color;
+        mask |= 1 << (x - stampX);
+    }
 
-            glm::vec3 worldPos = a.worldPos * w + b.worldPos * v + c.worldPos * u;
-            glm::vec3 originalPos = a.originalPos * w + b.originalPos * v + c.originalPos * u;
+    void flush() {
+        if (mask == 0)
+            return;
 
-            fragments.push_back(
-                    Fragment{
-                            glm::vec3(x, y, z),
-                            color,
-                            intensity,
-                            worldPos,
-                            originalPos
-                    }
-            );
+        alignas(16) Pixel pixels[STAMP_WIDTH];
+        packKernel(colors, pixels);
+        for (; mask != 0; mask &= mask - 1) {
+            int i = std::countr_zero(static_cast<unsigned>(mask));
+            colorAt(stampX + i, stampY) = pixels[i];
         }
     }
-    return fragments;
-}
\ No newline at end of file
+};
@@ -2,13 +2,7 @@
 #pragma once
 
 #include <glm/glm.hpp>
-
-struct Uniforms {
-    glm::mat4 model;
-    glm::mat4 view;
-    glm::mat4 projection;
-    glm::mat4 viewport;
-};
+#include "camera.h"
 
 glm::mat4 createShipModelMatrix(glm::vec3 translationVector, glm::vec3 scaleVector) {
     // ajustar la nave en z
@@ -29,20 +23,20 @@ glm::mat4 createModelMatrix(glm::vec3 translationVector, glm::vec3 scaleVector,
     return translate * scale * rotation;
 }
 
-glm::mat4 createProjectionMatrix() {
+glm::mat4 createProjectionMatrix(int width, int height) {
     float fovInDegrees = 45.0f;
-    float aspectRatio = (float)SCREEN_WIDTH / (float)SCREEN_HEIGHT; // cast to float
+    float aspectRatio = (float)width / (float)height; // cast to float
     float nearClip = 0.1f;
     float farClip = 100.0f;
 
     return glm::perspective(glm::radians(fovInDegrees), aspectRatio, nearClip, farClip);
 }
 
-glm::mat4 createViewportMatrix() {
+glm::mat4 createViewportMatrix(int width, int height) {
     glm::mat4 viewport = glm::mat4(1.0f);
 
     // Scale
-    viewport = glm::scale(viewport, glm::vec3(SCREEN_WIDTH / 2.0f, SCREEN_HEIGHT / 2.0f, 0.5f));
+    viewport = glm::scale(viewport, glm::vec3(width / 2.0f, height / 2.0f, 0.5f));
 
     // Translate
     viewport = glm::translate(viewport, glm::vec3(1.0f, 1.0f, 0.5f));
@@ -50,11 +44,34 @@ glm::mat4 createViewportMatrix() {
     return viewport;
 }
 
-Uniforms planetBaseUniform(Camera camera) {
-    Uniforms uniforms{};
-    uniforms.view = createViewMatrix(camera);
-    uniforms.projection = createProjectionMatrix();
-    uniforms.viewport = createViewportMatrix();
+// Shared by every draw of a frame, computed once per frame
+struct FrameUniforms {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 viewport;
+    glm::mat4 viewProjection;
+};
+
+FrameUniforms createFrameUniforms(const Camera& camera, int width, int height) {
+    FrameUniforms frame{};
+    frame.view = createViewMatrix(camera);
+    frame.projection = createProjectionMatrix(width, height);
+    frame.viewport = createViewportMatrix(width, height);
+    frame.viewProjection = frame.projection * frame.view;
+    return frame;
+}
+
+// Per draw: the matrices the vertex stage reads, already combined with the frame's
+struct DrawUniforms {
+    glm::mat4 model;
+    glm::mat4 modelViewProjection;
+    glm::mat3 normal; // inverse transpose of the model's 3x3 part, correct under non-uniform scale
+};
 
-    return uniforms;
+DrawUniforms createDrawUniforms(const glm::mat4& model, const FrameUniforms& frame) {
+    DrawUniforms draw{};
+    draw.model = model;
+    draw.modelViewProjection = frame.viewProjection * model;
+    draw.normal = glm::transpose(glm::inverse(glm::mat3(model)));
+    return draw;
 }
@@ -0,0 +1,176 @@
+// vertices.h
+#pragma once
+#include <vector>
+#include "object.h"
+#include "shaders.h"
+#include "stamp.h"
+
+// Runs the vertex shader over every vertex of a mesh, writing mesh.vertexCount() vertices
+typedef void (*VertexKernel)(const Mesh& mesh, const DrawUniforms& uniforms, Vertex* out);
+
+// Runs the vertex shader over every vertex of a mesh once per instance. out holds
+// instanceCount * mesh.vertexCount() vertices, all the vertices of one instance after another.
+typedef void (*InstanceKernel)(const Mesh& mesh, const DrawUniforms& uniforms, const Instance* instances, int instanceCount, Vertex* out);
+
+// Instances are transformed this many at a time: every batch of vertices is loaded once
+// and shaded for the whole group
+const int INSTANCE_GROUP = 8;
+
+// Uniforms of one instance of a draw. The instance's normal matrix was inverted when its
+// buffer was built, so this is only matrix products.
+DrawUniforms createInstanceUniforms(const DrawUniforms& draw, const Instance& instance) {
+    DrawUniforms uniforms{};
+    uniforms.model = draw.model * instance.transform;
+    uniforms.modelViewProjection = draw.modelViewProjection * instance.transform;
+    uniforms.normal = draw.normal * instance.normal;
+    return uniforms;
+}
+
+// Reference implementation: vertexShader() one vertex at a time
+void shadeVerticesScalar(const Mesh& mesh, const DrawUniforms& uniforms, Vertex* out) {
+    for (size_t i = 0; i < mesh.vertexCount(); ++i) {
+        out[i] = vertexShader(mesh.vertex(i), uniforms);
+    }
+}
+
+// Reference implementation: the whole mesh for one instance, then the next
+void shadeInstancesScalar(const Mesh& mesh, const DrawUniforms& uniforms, const Instance* instances, int instanceCount, Vertex* out) {
+    for (int k = 0; k < instanceCount; ++k) {
+        shadeVerticesScalar(mesh, createInstanceUniforms(uniforms, instances[k]), out + k * mesh.vertexCount());
+    }
+}
+
+#ifdef STAMP_X86
+
+// a * x + b * y + c * z, in the order vertexShader() evaluates it
+STAMP_TARGET("avx2")
+inline __m256 linearAVX2(float a, float b, float c, __m256 x, __m256 y, __m256 z) {
+    return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(a), x), _mm256_mul_ps(_mm256_set1_ps(b), y)), _mm256_mul_ps(_mm256_set1_ps(c), z));
+}
+
+// Row r of an affine transform (matrix times (x, y, z, 1))
+STAMP_TARGET("avx2")
+inline __m256 affineRowAVX2(const glm::mat4& m, int r, __m256 x, __m256 y, __m256 z) {
+    return _mm256_add_ps(linearAVX2(m[0][r], m[1][r], m[2][r], x, y, z), _mm256_set1_ps(m[3][r]));
+}
+
+// Shades vertices i to i + 7, already loaded from the SoA streams, into out[i..i + 7]. No
+// FMA, so the results are bit-identical to the scalar reference (unless the compiler
+// contracts the scalar code into FMAs, e.g. with -march=native).
+STAMP_TARGET("avx2")
+inline void shadeEightAVX2(const Mesh& mesh, size_t i, __m256 px, __m256 py, __m256 pz, __m256 nx, __m256 ny, __m256 nz, const DrawUniforms& uniforms, Vertex* out) {
+    const glm::mat4& mvp = uniforms.modelViewProjection;
+    const glm::mat4& model = uniforms.model;
+    const glm::mat3& normalMatrix = uniforms.normal;
+
+    alignas(32) float clip[4][8];
+    alignas(32) float world[3][8];
+    alignas(32) float normal[3][8];
+
+    for (int r = 0; r < 4; ++r) {
+        _mm256_store_ps(clip[r], affineRowAVX2(mvp, r, px, py, pz));
+    }
+    for (int r = 0; r < 3; ++r) {
+        _mm256_store_ps(world[r], affineRowAVX2(model, r, px, py, pz));
+    }
+
+    __m256 tx = linearAVX2(normalMatrix[0][0], normalMatrix[1][0], normalMatrix[2][0], nx, ny, nz);
+    __m256 ty = linearAVX2(normalMatrix[0][1], normalMatrix[1][1], normalMatrix[2][1], nx, ny, nz);
+    __m256 tz = linearAVX2(normalMatrix[0][2], normalMatrix[1][2], normalMatrix[2][2], nx, ny, nz);
+
+    __m256 lengthSquared = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, tx), _mm256_mul_ps(ty, ty)), _mm256_mul_ps(tz, tz));
+    __m256 invLength = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(lengthSquared));
+    _mm256_store_ps(normal[0], _mm256_mul_ps(tx, invLength));
+    _mm256_store_ps(normal[1], _mm256_mul_ps(ty, invLength));
+    _mm256_store_ps(normal[2], _mm256_mul_ps(tz, invLength));
+
+    // Back to one Vertex per corner for primitive assembly
+    for (int lane = 0; lane < 8; ++lane) {
+        size_t v = i + lane;
+        out[v] = Vertex{
+                glm::vec3(),
+                glm::vec3(normal[0][lane], normal[1][lane], normal[2][lane]),
+                mesh.texCoords[v],
+                glm::vec3(world[0][lane], world[1][lane], world[2][lane]),
+                glm::vec3(mesh.positionX[v], mesh.positionY[v], mesh.positionZ[v]),
+                glm::vec4(clip[0][lane], clip[1][lane], clip[2][lane], clip[3][lane])
+        };
+    }
+}
+
+// Eight vertices per iteration, read straight from the SoA streams
+STAMP_TARGET("avx2")
+void shadeVerticesAVX2(const Mesh& mesh, const DrawUniforms& uniforms, Vertex* out) {
+    size_t count = mesh.vertexCount();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        shadeEightAVX2(mesh, i,
+                       _mm256_loadu_ps(&mesh.positionX[i]), _mm256_loadu_ps(&mesh.positionY[i]), _mm256_loadu_ps(&mesh.positionZ[i]),
+                       _mm256_loadu_ps(&mesh.normalX[i]), _mm256_loadu_ps(&mesh.normalY[i]), _mm256_loadu_ps(&mesh.normalZ[i]),
+                       uniforms, out);
+    }
+
+    for (; i < count; ++i) {
+        out[i] = vertexShader(mesh.vertex(i), uniforms);
+    }
+}
+
+// Streams the mesh once per group of INSTANCE_GROUP instances: each batch of eight
+// vertices is loaded once and shaded with every instance's matrices of the group
+STAMP_TARGET("avx2")
+void shadeInstancesAVX2(const Mesh& mesh, const DrawUniforms& uniforms, const Instance* instances, int instanceCount, Vertex* out) {
+    size_t count = mesh.vertexCount();
+    DrawUniforms group[INSTANCE_GROUP];
+
+    for (int first = 0; first < instanceCount; first += INSTANCE_GROUP) {
+        int groupSize = std::min(INSTANCE_GROUP, instanceCount - first);
+        for (int k = 0; k < groupSize; ++k) {
+            group[k] = createInstanceUniforms(uniforms, instances[first + k]);
+        }
+
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m256 px = _mm256_loadu_ps(&mesh.positionX[i]);
+            __m256 py = _mm256_loadu_ps(&mesh.positionY[i]);
+            __m256 pz = _mm256_loadu_ps(&mesh.positionZ[i]);
+            __m256 nx = _mm256_loadu_ps(&mesh.normalX[i]);
+            __m256 ny = _mm256_loadu_ps(&mesh.normalY[i]);
+            __m256 nz = _mm256_loadu_ps(&mesh.normalZ[i]);
+
+            for (int k = 0; k < groupSize; ++k) {
+                shadeEightAVX2(mesh, i, px, py, pz, nx, ny, nz, group[k], out + (first + k) * count);
+            }
+        }
+
+        for (; i < count; ++i) {
+            Vertex vertex = mesh.vertex(i);
+            for (int k = 0; k < groupSize; ++k) {
+                out[(first + k) * count + i] = vertexShader(vertex, group[k]);
+            }
+        }
+    }
+}
+
+#endif
+
+// SSE4.1 has no vertex kernel of its own; it gains little over the scalar code here
+VertexKernel selectVertexKernel(SimdLevel level) {
+#ifdef STAMP_X86
+    if (level == SimdLevel::AVX2) {
+        return shadeVerticesAVX2;
+    }
+#endif
+    return shadeVerticesScalar;
+}
+
+InstanceKernel selectInstanceKernel(SimdLevel level) {
+#ifdef STAMP_X86
+    if (level == SimdLevel::AVX2) {
+        return shadeInstancesAVX2;
+    }
+#endif
+    return shadeInstancesScalar;
+}
+
+VertexKernel vertexKernel = selectVertexKernel(simdLevel);
+InstanceKernel instanceKernel = selectInstanceKernel(simdLevel);
@@ -0,0 +1,47 @@
+// visibility.h
+#pragma once
+#include <array>
+#include <vector>
+#include "gl.h"
+#include "tiles.h"
+
+// Visibility buffer: instead of shading while rasterizing, every pixel remembers which
+// triangle of which draw is visible and where inside it. Shading then runs exactly once
+// per covered pixel, no matter how many triangles overlapped it.
+struct VisibilitySample {
+    int draw;     // model index, -1 when nothing was rasterized here
+    int triangle; // index into the frame's binned triangles
+    float v;      // barycentric weights of B and C
+    float u;
+};
+
+// Row-major, screenWidth samples per row
+std::vector<VisibilitySample> visibilityBuffer;
+
+void resizeVisibility() {
+    visibilityBuffer.assign(screenWidth * screenHeight, VisibilitySample{-1, -1, 0.0f, 0.0f});
+    visibilityBuffer.shrink_to_fit();
+}
+
+VisibilitySample& visibilityAt(int x, int y) {
+    return visibilityBuffer[y * screenWidth + x];
+}
+
+void clearVisibility(const TileRect& rect) {
+    for (int y = rect.minY; y <= rect.maxY; ++y) {
+        std::fill(&visibilityAt(rect.minX, y), &visibilityAt(rect.maxX, y) + 1, VisibilitySample{-1, -1, 0.0f, 0.0f});
+    }
+}
+
+// Visible pixels of one tile grouped by the shader that will color them
+struct ShadingQueues {
+    std::vector<std::vector<glm::ivec2>> pixels;
+
+    explicit ShadingQueues(int shaderCount) : pixels(shaderCount) {}
+
+    void reset() {
+        for (auto& queue : pixels) {
+            queue.clear();
+        }
+    }
+};
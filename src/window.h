@@ -0,0 +1,113 @@
+#pragma once
+#include <SDL.h>
+#include "gl.h"
+#include "present.h"
+
+SDL_Window* window = nullptr;
+SDL_Renderer* renderer = nullptr;
+SDL_Texture* texture = nullptr; // streaming texture the framebuffer is uploaded to every frame
+int textureWidth = 0;
+int textureHeight = 0;
+
+bool openWindow(int width, int height) {
+    if (SDL_Init(SDL_INIT_VIDEO) != 0) {
+        std::cerr << "Error: Failed to initialize SDL: " << SDL_GetError() << std::endl;
+        return false;
+    }
+
+    window = SDL_CreateWindow("Software Renderer", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, width, height, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
+    if (!window) {
+        std::cerr << "Error: Failed to create SDL window: " << SDL_GetError() << std::endl;
+        SDL_Quit();
+        return false;
+    }
+    return true;
+}
+
+void closeWindow() {
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+}
+
+// packColor() stores R, G, B, A in memory order. The texture reads the same bytes but
+// ignores the fourth one: the shaders leave alpha below 1 and the window is opaque.
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+const Uint32 texturePixelFormat = SDL_PIXELFORMAT_RGBX8888;
+#else
+const Uint32 texturePixelFormat = SDL_PIXELFORMAT_XBGR8888;
+#endif
+
+// (Re)creates the streaming texture for width x height frames. Uploading is a copy, and
+// the copy to the window replaces its pixels instead of blending over them.
+bool createTexture(int width, int height) {
+    if (texture) {
+        SDL_DestroyTexture(texture);
+    }
+
+    texture = SDL_CreateTexture(renderer, texturePixelFormat, SDL_TEXTUREACCESS_STREAMING, width, height);
+    if (!texture) {
+        std::cerr << "Error: Failed to create SDL texture: " << SDL_GetError() << std::endl;
+        return false;
+    }
+    SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_NONE);
+    textureWidth = width;
+    textureHeight = height;
+    return true;
+}
+
+// Presents into the window. SDL only allows rendering from the main thread (the one that
+// pumps events), so the renderer and the texture are created and used there only.
+class WindowSink : public FrameSink {
+public:
+    // With vsync every flip waits for the display refresh
+    explicit WindowSink(bool vsync) : vsync(vsync) {}
+
+    bool open() override {
+        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | (vsync ? SDL_RENDERER_PRESENTVSYNC : 0));
+        if (!renderer) {
+            std::cerr << "Error: Failed to create SDL renderer: " << SDL_GetError() << std::endl;
+            return false;
+        }
+
+        return createTexture(screenWidth, screenHeight);
+    }
+
+    void close() override {
+        if (texture) {
+            SDL_DestroyTexture(texture);
+            texture = nullptr;
+        }
+        if (renderer) {
+            SDL_DestroyRenderer(renderer);
+            renderer = nullptr;
+        }
+    }
+
+    // Copies the frame into the streaming texture, row by row
+    void upload(const ResolvedFrame& frame) override {
+        if ((textureWidth != frame.width || textureHeight != frame.height) && !createTexture(frame.width, frame.height)) {
+            return;
+        }
+
+        void* pixels = nullptr;
+        int pitch = 0;
+        if (SDL_LockTexture(texture, nullptr, &pixels, &pitch) != 0) {
+            return;
+        }
+
+        auto* dst = static_cast<unsigned char*>(pixels);
+        for (int y = 0; y < frame.height; ++y) {
+            std::memcpy(dst + y * pitch, &frame.pixels[size_t(y) * frame.width], frame.width * sizeof(Pixel));
+        }
+        SDL_UnlockTexture(texture);
+    }
+
+    // Draws the uploaded frame with a single copy, stretched to the window
+    void flip() override {
+        SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+        SDL_RenderPresent(renderer);
+    }
+
+private:
+    bool vsync;
+};
@@ -0,0 +1,290 @@
+// Equivalence tests for the SIMD kernels: every vector kernel the CPU supports has to
+// produce bit-identical results to its scalar reference. Returns non-zero on any mismatch.
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <string>
+#include "../src/stamp.h"
+#include "../src/vertices.h"
+
+// Set by CMake; the default works from the build directory next to src/
+#ifndef MODEL_DIR
+#define MODEL_DIR "../model/"
+#endif
+
+int failures = 0;
+
+bool sameBits(float a, float b) {
+    return std::memcmp(&a, &b, sizeof(float)) == 0;
+}
+
+void fail(const char* test, const char* kernel, int caseNumber, const char* what, int channel, int lane, float expected, float actual) {
+    if (failures < 20) {
+        std::printf("FAIL %s (%s) case %d: %s channel %d lane %d: expected %.9g, got %.9g\n", test, kernel, caseNumber, what, channel, lane, expected, actual);
+    }
+    ++failures;
+}
+
+// Kernels the CPU can run, the scalar reference first
+std::vector<SimdLevel> supportedLevels() {
+    std::vector<SimdLevel> levels;
+    for (SimdLevel level : {SimdLevel::Scalar, SimdLevel::SSE41, SimdLevel::AVX2}) {
+        if (level <= detectSimdLevel()) {
+            levels.push_back(level);
+        }
+    }
+    return levels;
+}
+
+// ---- Stamp kernels ----
+
+// Runs one stamp through every kernel and compares them with stampScalar: the masks, v and
+// u of every lane inside count (when any pixel is covered), and the first channelCount
+// channels of the covered lanes
+void checkStamp(int caseNumber, const StampSetup& setup, float dx, float dy, int count, int channelCount) {
+    PixelStamp expected;
+    stampScalar(setup, dx, dy, count, channelCount, expected);
+
+    for (SimdLevel level : supportedLevels()) {
+        if (level == SimdLevel::Scalar)
+            continue;
+
+        PixelStamp actual;
+        std::memset(&actual, 0, sizeof(actual));
+        selectStampKernel(level)(setup, dx, dy, count, channelCount, actual);
+        const char* kernel = simdLevelName(level);
+
+        if (actual.mask != expected.mask) {
+            fail("stamp", kernel, caseNumber, "mask", -1, -1, float(expected.mask), float(actual.mask));
+            continue;
+        }
+        if (expected.mask == 0)
+            continue;
+
+        for (int i = 0; i < count; ++i) {
+            if (!sameBits(expected.v[i], actual.v[i]))
+                fail("stamp", kernel, caseNumber, "v", -1, i, expected.v[i], actual.v[i]);
+            if (!sameBits(expected.u[i], actual.u[i]))
+                fail("stamp", kernel, caseNumber, "u", -1, i, expected.u[i], actual.u[i]);
+        }
+        for (int c = 0; c < channelCount; ++c) {
+            for (int i = 0; i < count; ++i) {
+                if ((expected.mask & (1 << i)) && !sameBits(expected.channels[c][i], actual.channels[c][i]))
+                    fail("stamp", kernel, caseNumber, "value", c, i, expected.channels[c][i], actual.channels[c][i]);
+            }
+        }
+    }
+}
+
+// Random triangle setups, mostly with the stamp straddling an edge so masks are partial.
+// Some setups have near-degenerate edges (tiny or zero gradients, weights right at the
+// coverage epsilon) and 1/w planes that get close to zero.
+void testStamps() {
+    std::mt19937 random(3);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> offset(0.0f, 64.0f);
+    std::uniform_int_distribution<int> kind(0, 4);
+    const int channelCounts[] = {1, FIRST_PERSPECTIVE_CHANNEL, FIRST_PERSPECTIVE_CHANNEL + 1, CHANNEL_COUNT};
+
+    int caseNumber = 0;
+    for (int n = 0; n < 20000; ++n) {
+        StampSetup setup;
+        int shape = kind(random);
+        for (int e = 0; e < 3; ++e) {
+            float scale = shape == 1 ? 1e-7f : 0.05f;
+            setup.edgeA[e] = unit(random) * scale;
+            setup.edgeB[e] = unit(random) * scale;
+            setup.edgeC[e] = unit(random) * 0.5f + 0.3f;
+        }
+        if (shape == 2) {
+            // Flat edges: the weights are the same across the stamp, right at the epsilon
+            setup.edgeA[1] = 0.0f;
+            setup.edgeB[1] = 0.0f;
+            setup.edgeC[1] = coverageEpsilon;
+        } else if (shape == 3) {
+            // Sliver: two edges almost parallel
+            setup.edgeA[2] = -setup.edgeA[0] * (1.0f + 1e-6f);
+            setup.edgeB[2] = -setup.edgeB[0] * (1.0f + 1e-6f);
+        }
+
+        for (int c = 0; c < CHANNEL_COUNT; ++c) {
+            setup.base[c] = unit(random) * 10.0f;
+            setup.dv[c] = unit(random) * 10.0f;
+            setup.du[c] = unit(random) * 10.0f;
+        }
+        setup.invWBase = shape == 4 ? 1e-30f : unit(random) * 0.5f + 0.6f;
+        setup.invWdv = unit(random) * 0.1f;
+        setup.invWdu = unit(random) * 0.1f;
+
+        float dx = shape == 0 ? offset(random) : unit(random) * 4.0f;
+        float dy = shape == 0 ? offset(random) : unit(random) * 4.0f;
+        for (int count = 1; count <= STAMP_WIDTH; ++count) {
+            for (int channelCount : channelCounts) {
+                checkStamp(caseNumber++, setup, dx, dy, count, channelCount);
+            }
+        }
+    }
+    std::printf("stamp kernels: %d cases\n", caseNumber);
+}
+
+// ---- Color packing ----
+
+// Random colors in and out of [0, 1], values that land exactly on a rounding boundary,
+// infinities and NaN; every pixel has to match packStampScalar
+void testPack() {
+    std::mt19937 random(20);
+    std::uniform_real_distribution<float> wide(-0.5f, 1.5f);
+    std::uniform_int_distribution<int> byte(0, 255);
+    std::uniform_int_distribution<int> kind(0, 5);
+    const float special[] = {0.0f, -0.0f, 1.0f, std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(), std::numeric_limits<float>::quiet_NaN()};
+
+    int caseNumber = 0;
+    for (int n = 0; n < 100000; ++n) {
+        alignas(16) Color colors[STAMP_WIDTH];
+        for (Color& color : colors) {
+            float* channels = &color.r;
+            for (int c = 0; c < 4; ++c) {
+                switch (kind(random)) {
+                    case 0:
+                        channels[c] = (byte(random) + 0.5f) / 255.0f;
+                        break;
+                    case 1:
+                        channels[c] = special[byte(random) % 6];
+                        break;
+                    default:
+                        channels[c] = wide(random);
+                        break;
+                }
+            }
+        }
+
+        Pixel expected[STAMP_WIDTH];
+        packStampScalar(colors, expected);
+        for (SimdLevel level : supportedLevels()) {
+            PackKernel kernel = selectPackKernel(level);
+            if (kernel == packStampScalar)
+                continue;
+
+            Pixel actual[STAMP_WIDTH];
+            kernel(colors, actual);
+            for (int i = 0; i < STAMP_WIDTH; ++i) {
+                if (actual[i] != expected[i])
+                    fail("pack", simdLevelName(level), caseNumber, "pixel", -1, i, float(expected[i]), float(actual[i]));
+            }
+        }
+        ++caseNumber;
+    }
+    std::printf("pack kernels: %d cases\n", caseNumber);
+}
+
+// ---- Vertex kernels ----
+
+// Every float of the post-transform vertices has to match shadeVerticesScalar
+void checkVertices(const char* meshName, int caseNumber, const Mesh& mesh, const DrawUniforms& uniforms) {
+    std::vector<Vertex> expected(mesh.vertexCount());
+    shadeVerticesScalar(mesh, uniforms, expected.data());
+
+    for (SimdLevel level : supportedLevels()) {
+        VertexKernel kernel = selectVertexKernel(level);
+        if (kernel == shadeVerticesScalar)
+            continue;
+
+        std::vector<Vertex> actual(mesh.vertexCount());
+        kernel(mesh, uniforms, actual.data());
+
+        for (size_t i = 0; i < mesh.vertexCount(); ++i) {
+            const float* want = &expected[i].position.x;
+            const float* got = &actual[i].position.x;
+            for (size_t f = 0; f < sizeof(Vertex) / sizeof(float); ++f) {
+                if (!sameBits(want[f], got[f]))
+                    fail(meshName, simdLevelName(level), caseNumber, "vertex float", int(f), int(i), want[f], got[f]);
+            }
+        }
+    }
+}
+
+// Same for the instanced kernels against shadeInstancesScalar
+void checkInstances(const char* meshName, int caseNumber, const Mesh& mesh, const DrawUniforms& uniforms, const std::vector<Instance>& instances) {
+    int instanceCount = static_cast<int>(instances.size());
+    std::vector<Vertex> expected(instanceCount * mesh.vertexCount());
+    shadeInstancesScalar(mesh, uniforms, instances.data(), instanceCount, expected.data());
+
+    for (SimdLevel level : supportedLevels()) {
+        InstanceKernel kernel = selectInstanceKernel(level);
+        if (kernel == shadeInstancesScalar)
+            continue;
+
+        std::vector<Vertex> actual(expected.size());
+        kernel(mesh, uniforms, instances.data(), instanceCount, actual.data());
+
+        for (size_t i = 0; i < expected.size(); ++i) {
+            const float* want = &expected[i].position.x;
+            const float* got = &actual[i].position.x;
+            for (size_t f = 0; f < sizeof(Vertex) / sizeof(float); ++f) {
+                if (!sameBits(want[f], got[f]))
+                    fail(meshName, simdLevelName(level), caseNumber, "instanced vertex float", int(f), int(i), want[f], got[f]);
+            }
+        }
+    }
+}
+
+// The scene's meshes (482, 880 and 12 vertices, so both with and without a tail shorter
+// than 8) under random model matrices with non-uniform scale, seen by the initial camera,
+// drawn once and instanced
+void testVertices() {
+    MeshRegistry meshes;
+    std::pair<const char*, MeshHandle> tested[] = {
+            {"sphere", meshes.load(std::string(MODEL_DIR) + "sphere.obj")},
+            {"ship", meshes.load(std::string(MODEL_DIR) + "naveEspacial.obj")},
+            {"icosahedron", meshes.add("icosahedron", createIcosahedronMesh())},
+    };
+
+    std::mt19937 random(23);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> scale(0.05f, 3.0f);
+    FrameUniforms frame = createFrameUniforms(setupInitialCamera(), 1280, 720);
+
+    int caseNumber = 0;
+    for (auto& [name, mesh] : tested) {
+        if (!mesh) {
+            std::printf("FAIL %s: mesh not loaded\n", name);
+            ++failures;
+            continue;
+        }
+        for (int n = 0; n < 50; ++n) {
+            glm::vec3 translation{unit(random) * 10.0f, unit(random) * 2.0f, unit(random) * 10.0f};
+            glm::vec3 axis{unit(random), unit(random), unit(random) + 2.0f};
+            glm::mat4 model = createModelMatrix(translation, glm::vec3{scale(random), scale(random), scale(random)}, glm::normalize(axis), unit(random) * 180.0f);
+            checkVertices(name, caseNumber++, *mesh, createDrawUniforms(model, frame));
+        }
+
+        // Instance counts below, at and past a multiple of INSTANCE_GROUP
+        for (int instanceCount : {1, INSTANCE_GROUP, 2 * INSTANCE_GROUP + 3}) {
+            std::vector<Instance> instances;
+            for (int k = 0; k < instanceCount; ++k) {
+                glm::vec3 translation{unit(random) * 3.0f, unit(random) * 3.0f, unit(random) * 3.0f};
+                glm::vec3 axis{unit(random), unit(random) + 2.0f, unit(random)};
+                glm::mat4 transform = createModelMatrix(translation, glm::vec3{scale(random), scale(random), scale(random)}, glm::normalize(axis), unit(random) * 180.0f);
+                instances.push_back(createInstance(transform, 0.0f));
+            }
+            glm::mat4 model = createModelMatrix(glm::vec3(0.0f, 0.0f, -2.0f), glm::vec3(0.5f), glm::vec3(0.0f, 1.0f, 0.0f), 30.0f);
+            checkInstances(name, caseNumber++, *mesh, createDrawUniforms(model, frame), instances);
+        }
+    }
+    std::printf("vertex kernels: %d cases\n", caseNumber);
+}
+
+int main() {
+    std::printf("CPU: %s\n", simdLevelName(detectSimdLevel()));
+    testStamps();
+    testPack();
+    testVertices();
+
+    if (failures > 0) {
+        std::printf("%d mismatches\n", failures);
+        return 1;
+    }
+    std::printf("OK\n");
+    return 0;
+}